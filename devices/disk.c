@@ -84,7 +84,11 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void select_sector (struct disk *, disk_sector_t, size_t cnt);
+static void read_sectors (struct disk *, disk_sector_t, size_t cnt,
+		void *buffer, void *const *sectors);
+static void write_sectors (struct disk *, disk_sector_t, size_t cnt,
+		const void *, const void *const *);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -209,47 +213,124 @@ disk_size (struct disk *d) {
    per-disk locking is unneeded. */
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
+	disk_read_multiple (d, sec_no, buffer, 1);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   DISK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
+	disk_write_multiple (d, sec_no, buffer, 1);
+}
+
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D
+   into BUFFER, which must have room for CNT * DISK_SECTOR_SIZE
+   bytes.  The whole range is transferred by a single command,
+   so the channel is only selected and locked once.
+   CNT must be between 1 and DISK_MAX_SECTORS. */
+void
+disk_read_multiple (struct disk *d, disk_sector_t sec_no, void *buffer,
+		size_t cnt) {
+	ASSERT (buffer != NULL);
+	read_sectors (d, sec_no, cnt, buffer, NULL);
+}
+
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D
+   with a single command, like disk_read_multiple(), except that
+   the I'th sector goes to SECTORS[I].  Lets the caller scatter
+   one transfer into buffers spread in memory. */
+void
+disk_read_vector (struct disk *d, disk_sector_t sec_no,
+		void *const sectors[], size_t cnt) {
+	ASSERT (sectors != NULL);
+	read_sectors (d, sec_no, cnt, NULL, sectors);
+}
+
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D
+   from BUFFER, which must contain CNT * DISK_SECTOR_SIZE bytes,
+   with a single command.  Returns after the disk has
+   acknowledged receiving the data.
+   CNT must be between 1 and DISK_MAX_SECTORS. */
+void
+disk_write_multiple (struct disk *d, disk_sector_t sec_no,
+		const void *buffer, size_t cnt) {
+	ASSERT (buffer != NULL);
+	write_sectors (d, sec_no, cnt, buffer, NULL);
+}
+
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D
+   with a single command, like disk_write_multiple(), except that
+   the I'th sector is taken from SECTORS[I].  Lets the caller
+   gather sectors scattered in memory into one transfer. */
+void
+disk_write_vector (struct disk *d, disk_sector_t sec_no,
+		const void *const sectors[], size_t cnt) {
+	ASSERT (sectors != NULL);
+	write_sectors (d, sec_no, cnt, NULL, sectors);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D, into BUFFER
+   if it is nonnull, otherwise into SECTORS. */
+static void
+read_sectors (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		void *buffer, void *const *sectors) {
 	struct channel *c;
+	size_t i;
 
 	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
+	ASSERT (cnt > 0 && cnt <= DISK_MAX_SECTORS);
 
 	c = d->channel;
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
+	select_sector (d, sec_no, cnt);
 	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-	input_sector (c, buffer);
-	d->read_cnt++;
+	/* The device interrupts once per sector it has ready. */
+	for (i = 0; i < cnt; i++) {
+		sema_down (&c->completion_wait);
+		if (!wait_while_busy (d))
+			PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name,
+					sec_no + (disk_sector_t) i);
+		input_sector (c, buffer != NULL
+				? (uint8_t *) buffer + i * DISK_SECTOR_SIZE
+				: sectors[i]);
+	}
+	d->read_cnt += cnt;
 	lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   DISK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
-void
-disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
+/* Writes CNT sectors starting at SEC_NO to disk D, taking them
+   from BUFFER if it is nonnull, otherwise from SECTORS. */
+static void
+write_sectors (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		const void *buffer, const void *const *sectors) {
 	struct channel *c;
+	size_t i;
 
 	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
+	ASSERT (cnt > 0 && cnt <= DISK_MAX_SECTORS);
 
 	c = d->channel;
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
+	select_sector (d, sec_no, cnt);
 	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-	output_sector (c, buffer);
-	sema_down (&c->completion_wait);
-	d->write_cnt++;
+	/* The device asks for each sector in turn and interrupts once
+	   it has taken it. */
+	for (i = 0; i < cnt; i++) {
+		if (!wait_while_busy (d))
+			PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name,
+					sec_no + (disk_sector_t) i);
+		output_sector (c, buffer != NULL
+				? (const uint8_t *) buffer + i * DISK_SECTOR_SIZE
+				: sectors[i]);
+		sema_down (&c->completion_wait);
+	}
+	d->write_cnt += cnt;
 	lock_release (&c->lock);
 }
-
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -402,17 +483,19 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the number of sectors CNT to the disk's
+   sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) {
 	struct channel *c = d->channel;
 
-	ASSERT (sec_no < d->capacity);
-	ASSERT (sec_no < (1UL << 28));
+	ASSERT (sec_no + cnt <= d->capacity);
+	ASSERT (sec_no + cnt <= (1UL << 28));
+	ASSERT (cnt > 0 && cnt <= DISK_MAX_SECTORS);
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
+	/* A count of 0 stands for DISK_MAX_SECTORS. */
+	outb (reg_nsect (c), cnt == DISK_MAX_SECTORS ? 0 : cnt);
 	outb (reg_lbal (c), sec_no);
 	outb (reg_lbam (c), sec_no >> 8);
 	outb (reg_lbah (c), (sec_no >> 16));
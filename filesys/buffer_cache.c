@@ -0,0 +1,297 @@
+/* buffer_cache.c: Cache of file system disk sectors.
+ *
+ * Every sector inode.c reads or writes goes through a fixed array of
+ * BUFFER_CACHE_SIZE entries. A hit costs a memcpy; a miss evicts an entry
+ * chosen by the clock algorithm. Writes only dirty the entry: the sector
+ * goes to disk when its entry is evicted, when the flusher thread wakes
+ * up, or in filesys_done().
+ *
+ * cache_lock protects the index (the hash buckets, each entry's sector,
+ * pin count and clock bit). Each entry's lock protects its data and
+ * dirty bit and is held across the disk I/O of that entry, so that one
+ * miss does not stall hits on other sectors. A pinned entry is never
+ * chosen as a victim. */
+
+#include "filesys/buffer_cache.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of cached sectors. */
+#define BUFFER_CACHE_SIZE 64
+
+/* Number of hash buckets. Must be a power of 2. */
+#define BUFFER_CACHE_BUCKETS 64
+
+/* Ticks between two passes of the flusher. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+
+/* A cached sector. */
+struct cache_entry {
+	disk_sector_t sector;               /* Cached sector, if valid. */
+	bool valid;                         /* Holds a sector? */
+	bool accessed;                      /* Clock bit. */
+	int pin_cnt;                        /* Users; not evictable if > 0. */
+	struct list_elem elem;              /* Element in hash bucket. */
+
+	struct lock lock;                   /* Protects data and dirty. */
+	bool dirty;                         /* Modified since read? */
+	uint8_t data[DISK_SECTOR_SIZE];     /* Sector content. */
+};
+
+static struct cache_entry cache[BUFFER_CACHE_SIZE];
+static struct list buckets[BUFFER_CACHE_BUCKETS];
+static struct lock cache_lock;
+static size_t clock_hand;
+
+/* Statistics. */
+static long long hit_cnt;			/* Number of lookups served by the cache. */
+static long long miss_cnt;			/* Number of sectors read into the cache. */
+static long long writeback_cnt;		/* Number of dirty sectors written back. */
+static long long bypass_cnt;		/* Number of sectors read past the cache. */
+
+static void flusher (void *aux);
+
+/* Initializes the buffer cache and starts the flusher thread. */
+void
+buffer_cache_init (void) {
+	size_t i;
+
+	lock_init (&cache_lock);
+	for (i = 0; i < BUFFER_CACHE_BUCKETS; i++)
+		list_init (&buckets[i]);
+	for (i = 0; i < BUFFER_CACHE_SIZE; i++)
+		lock_init (&cache[i].lock);
+	thread_create ("bcflush", PRI_DEFAULT, flusher, NULL);
+}
+
+static struct list *
+bucket (disk_sector_t sector) {
+	return &buckets[sector & (BUFFER_CACHE_BUCKETS - 1)];
+}
+
+/* Returns the entry caching SECTOR, or NULL.
+ * Must be called with cache_lock held. */
+static struct cache_entry *
+lookup (disk_sector_t sector) {
+	struct list *b = bucket (sector);
+	struct list_elem *e;
+
+	for (e = list_begin (b); e != list_end (b); e = list_next (e)) {
+		struct cache_entry *c = list_entry (e, struct cache_entry, elem);
+		if (c->sector == sector)
+			return c;
+	}
+	return NULL;
+}
+
+/* Picks an unpinned entry by the clock algorithm, or returns NULL if
+ * every entry is pinned. Must be called with cache_lock held. */
+static struct cache_entry *
+pick_victim (void) {
+	size_t i;
+
+	for (i = 0; i < 2 * BUFFER_CACHE_SIZE; i++) {
+		struct cache_entry *c = &cache[clock_hand];
+		clock_hand = (clock_hand + 1) % BUFFER_CACHE_SIZE;
+		if (c->pin_cnt > 0)
+			continue;
+		if (!c->valid || !c->accessed)
+			return c;
+		c->accessed = false;
+	}
+	return NULL;
+}
+
+/* Writes C back if it is dirty. C's lock must be held. */
+static void
+writeback (struct cache_entry *c) {
+	ASSERT (lock_held_by_current_thread (&c->lock));
+	if (c->valid && c->dirty) {
+		disk_write (filesys_disk, c->sector, c->data);
+		c->dirty = false;
+		writeback_cnt++;
+	}
+}
+
+static void
+unpin (struct cache_entry *c) {
+	lock_acquire (&cache_lock);
+	c->pin_cnt--;
+	lock_release (&cache_lock);
+}
+
+/* Returns the entry for SECTOR, pinned and locked. If the sector is not
+ * cached, evicts an entry for it and, if LOAD, reads the sector in;
+ * otherwise the caller is about to overwrite the whole sector. */
+static struct cache_entry *
+cache_get (disk_sector_t sector, bool load) {
+	for (;;) {
+		struct cache_entry *c;
+
+		lock_acquire (&cache_lock);
+		c = lookup (sector);
+		if (c != NULL) {
+			c->pin_cnt++;
+			c->accessed = true;
+			hit_cnt++;
+			lock_release (&cache_lock);
+
+			lock_acquire (&c->lock);
+			if (c->valid && c->sector == sector)
+				return c;
+			/* Reused for another sector while we waited. */
+			lock_release (&c->lock);
+			unpin (c);
+			continue;
+		}
+
+		c = pick_victim ();
+		if (c == NULL) {
+			lock_release (&cache_lock);
+			thread_yield ();
+			continue;
+		}
+		c->pin_cnt++;
+		lock_release (&cache_lock);
+
+		/* The victim stays indexed under its old sector until it is
+		 * written back, so that nobody reads that sector from disk
+		 * in the meantime. */
+		lock_acquire (&c->lock);
+		writeback (c);
+
+		lock_acquire (&cache_lock);
+		if (lookup (sector) != NULL) {
+			/* Someone else brought SECTOR in meanwhile. */
+			lock_release (&cache_lock);
+			lock_release (&c->lock);
+			unpin (c);
+			continue;
+		}
+		if (c->valid)
+			list_remove (&c->elem);
+		c->sector = sector;
+		c->valid = true;
+		c->accessed = true;
+		list_push_front (bucket (sector), &c->elem);
+		miss_cnt++;
+		lock_release (&cache_lock);
+
+		if (load)
+			disk_read (filesys_disk, sector, c->data);
+		return c;
+	}
+}
+
+static void
+cache_put (struct cache_entry *c) {
+	lock_release (&c->lock);
+	unpin (c);
+}
+
+/* Reads SIZE bytes at offset OFS of SECTOR into BUFFER. */
+void
+buffer_cache_read (disk_sector_t sector, void *buffer, int ofs, int size) {
+	struct cache_entry *c;
+
+	ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	c = cache_get (sector, true);
+	memcpy (buffer, c->data + ofs, size);
+	cache_put (c);
+}
+
+/* Reads the CNT sectors from SECTOR on into BUFFER. Cached sectors are
+ * copied out of the cache; each run of the others is read from the disk
+ * in a single command, past the cache, so that a long streaming read
+ * does not flush it. */
+void
+buffer_cache_read_multiple (disk_sector_t sector, void *buffer_,
+		size_t cnt) {
+	uint8_t *buffer = buffer_;
+	size_t i = 0;
+
+	while (i < cnt) {
+		size_t run = 0;
+
+		lock_acquire (&cache_lock);
+		while (i + run < cnt && lookup (sector + i + run) == NULL)
+			run++;
+		lock_release (&cache_lock);
+
+		if (run == 0) {
+			buffer_cache_read (sector + i, buffer + i * DISK_SECTOR_SIZE,
+					0, DISK_SECTOR_SIZE);
+			i++;
+		} else {
+			disk_read_multiple (filesys_disk, sector + i,
+					buffer + i * DISK_SECTOR_SIZE, run);
+			bypass_cnt += run;
+			i += run;
+		}
+	}
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS of SECTOR. The sector
+ * reaches the disk later. */
+void
+buffer_cache_write (disk_sector_t sector, const void *buffer,
+		int ofs, int size) {
+	struct cache_entry *c;
+
+	ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	c = cache_get (sector, size < DISK_SECTOR_SIZE);
+	memcpy (c->data + ofs, buffer, size);
+	c->dirty = true;
+	cache_put (c);
+}
+
+/* Writes every dirty sector back to disk. */
+void
+buffer_cache_flush (void) {
+	size_t i;
+
+	for (i = 0; i < BUFFER_CACHE_SIZE; i++) {
+		struct cache_entry *c = &cache[i];
+
+		lock_acquire (&cache_lock);
+		c->pin_cnt++;
+		lock_release (&cache_lock);
+
+		lock_acquire (&c->lock);
+		writeback (c);
+		cache_put (c);
+	}
+}
+
+/* Writes every dirty sector back, at shutdown. */
+void
+buffer_cache_done (void) {
+	buffer_cache_flush ();
+}
+
+/* Writes dirty sectors back every FLUSH_INTERVAL ticks, so that a crash
+ * loses at most that much. The file system's allocation metadata is
+ * flushed into the cache first, so it goes out with the same pass. */
+static void
+flusher (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (FLUSH_INTERVAL);
+		filesys_flush ();
+	}
+}
+
+/* Prints buffer cache statistics. */
+void
+buffer_cache_print_stats (void) {
+	printf ("Buffer cache: %lld hits, %lld misses, %lld writebacks, "
+			"%lld sectors read past\n", hit_cnt, miss_cnt, writeback_cnt,
+			bypass_cnt);
+}
@@ -1,5 +1,8 @@
 #include "filesys/fat.h"
+#include <bitmap.h>
+#include <round.h>
 #include "devices/disk.h"
+#include "filesys/buffer_cache.h"
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
@@ -24,12 +27,16 @@ struct fat_fs {
 	disk_sector_t data_start;
 	cluster_t last_clst;
 	struct lock write_lock;
+	struct bitmap *used;	/* Clusters in use, mirrors the FAT. */
+	size_t free_cnt;		/* Number of free clusters. */
+	struct bitmap *dirty;	/* FAT sectors changed since the last flush. */
 };
 
 static struct fat_fs *fat_fs;
 
 void fat_boot_create (void);
 void fat_fs_init (void);
+static void fat_index_init (void);
 
 void
 fat_init (void) {
@@ -78,6 +85,7 @@ fat_open (void) {
 			free (bounce);
 		}
 	}
+	fat_index_init ();
 }
 
 void
@@ -87,30 +95,36 @@ fat_close (void) {
 	if (bounce == NULL)
 		PANIC ("FAT close failed");
 	memcpy (bounce, &fat_fs->bs, sizeof (fat_fs->bs));
-	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
+	buffer_cache_write (FAT_BOOT_SECTOR, bounce, 0, DISK_SECTOR_SIZE);
 	free (bounce);
 
-	// Write FAT directly to the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
-		}
+	// Write the FAT sectors that changed since the last flush
+	fat_flush ();
+}
+
+/* Writes the FAT sectors that changed since the last flush. They go to
+ * the buffer cache, which puts them on disk with its next flush, so a
+ * cluster allocation costs one sector write instead of the whole FAT. */
+void
+fat_flush (void) {
+	size_t fat_size, i;
+
+	if (fat_fs == NULL || fat_fs->dirty == NULL)
+		return;
+	fat_size = fat_fs->fat_length * sizeof (cluster_t);
+
+	lock_acquire (&fat_fs->write_lock);
+	for (i = 0; (i = bitmap_scan (fat_fs->dirty, i, 1, true)) != BITMAP_ERROR;
+			i++) {
+		size_t ofs = i * DISK_SECTOR_SIZE;
+		size_t size = fat_size - ofs < DISK_SECTOR_SIZE
+			? fat_size - ofs : DISK_SECTOR_SIZE;
+
+		buffer_cache_write (fat_fs->bs.fat_start + i,
+				(uint8_t *) fat_fs->fat + ofs, 0, size);
+		bitmap_reset (fat_fs->dirty, i);
 	}
+	lock_release (&fat_fs->write_lock);
 }
 
 void
@@ -125,13 +139,16 @@ fat_create (void) {
 		PANIC ("FAT creation failed");
 
 	// Set up ROOT_DIR_CLST
+	fat_index_init ();
+	bitmap_set_all (fat_fs->dirty, true);
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
 
 	// Fill up ROOT_DIR_CLUSTER region with 0
 	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
 	if (buf == NULL)
 		PANIC ("FAT create failed due to OOM");
-	disk_write (filesys_disk, cluster_to_sector (ROOT_DIR_CLUSTER), buf);
+	buffer_cache_write (cluster_to_sector (ROOT_DIR_CLUSTER), buf,
+			0, DISK_SECTOR_SIZE);
 	free (buf);
 }
 
@@ -152,7 +169,64 @@ fat_boot_create (void) {
 
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	unsigned int fat_entries =
+	    fat_fs->bs.fat_sectors * (DISK_SECTOR_SIZE / sizeof (cluster_t));
+
+	/* Cluster 0 means "no cluster", so cluster N is the (N - 1)'th
+	 * cluster of the data area, right after the FAT. */
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+	fat_fs->fat_length =
+	    (fat_fs->bs.total_sectors - fat_fs->data_start) / SECTORS_PER_CLUSTER + 1;
+	if (fat_fs->fat_length > fat_entries)
+		fat_fs->fat_length = fat_entries;
+	fat_fs->last_clst = ROOT_DIR_CLUSTER + 1;
+	lock_init (&fat_fs->write_lock);
+}
+
+/* Builds the free-cluster index from the FAT, just loaded or created.
+ * A free cluster then takes O(1) to find in most cases: the next one
+ * after the chain being grown, or the next free one after last_clst.
+ * Also starts tracking the FAT sectors to flush, none so far. */
+static void
+fat_index_init (void) {
+	if (fat_fs->used == NULL) {
+		fat_fs->used = bitmap_create (fat_fs->fat_length);
+		fat_fs->dirty = bitmap_create (DIV_ROUND_UP (
+					fat_fs->fat_length * sizeof (cluster_t), DISK_SECTOR_SIZE));
+		if (fat_fs->used == NULL || fat_fs->dirty == NULL)
+			PANIC ("FAT index creation failed");
+	}
+	bitmap_set_all (fat_fs->dirty, false);
+	fat_fs->free_cnt = 0;
+	for (cluster_t clst = 1; clst < fat_fs->fat_length; clst++) {
+		bool used = fat_fs->fat[clst] != 0;
+		bitmap_set (fat_fs->used, clst, used);
+		if (!used)
+			fat_fs->free_cnt++;
+	}
+	bitmap_mark (fat_fs->used, 0);
+}
+
+/* Takes a free cluster out of the index, preferably the one right after
+ * NEAR so that a growing chain stays contiguous. Returns 0 if the disk
+ * is full. */
+static cluster_t
+fat_alloc_cluster (cluster_t near) {
+	cluster_t clst;
+
+	if (fat_fs->free_cnt == 0)
+		return 0;
+	if (near != 0 && near + 1 < fat_fs->fat_length
+			&& !bitmap_test (fat_fs->used, near + 1))
+		clst = near + 1;
+	else {
+		clst = bitmap_scan (fat_fs->used, fat_fs->last_clst, 1, false);
+		if (clst == BITMAP_ERROR)
+			clst = bitmap_scan (fat_fs->used, 1, 1, false);
+		ASSERT (clst != BITMAP_ERROR);
+	}
+	fat_fs->last_clst = clst + 1 < fat_fs->fat_length ? clst + 1 : 1;
+	return clst;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -164,30 +238,66 @@ fat_fs_init (void) {
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	cluster_t new_clst;
+
+	lock_acquire (&fat_fs->write_lock);
+	new_clst = fat_alloc_cluster (clst);
+	if (new_clst != 0) {
+		fat_put (new_clst, EOChain);
+		if (clst != 0)
+			fat_put (clst, new_clst);
+	}
+	lock_release (&fat_fs->write_lock);
+	return new_clst;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	if (pclst != 0)
+		fat_put (pclst, EOChain);
+	while (clst != EOChain) {
+		cluster_t next = fat_get (clst);
+		fat_put (clst, 0);
+		clst = next;
+	}
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+	if ((fat_fs->fat[clst] != 0) != (val != 0)) {
+		bitmap_set (fat_fs->used, clst, val != 0);
+		if (val != 0)
+			fat_fs->free_cnt--;
+		else
+			fat_fs->free_cnt++;
+	}
+	fat_fs->fat[clst] = val;
+	bitmap_mark (fat_fs->dirty, clst * sizeof (cluster_t) / DISK_SECTOR_SIZE);
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+	return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst != 0 && clst < fat_fs->fat_length);
+	return fat_fs->data_start + (clst - 1) * SECTORS_PER_CLUSTER;
+}
+
+/* Convert a sector number in the data area to its cluster #. */
+cluster_t
+sector_to_cluster (disk_sector_t sector) {
+	ASSERT (sector >= fat_fs->data_start);
+	return (sector - fat_fs->data_start) / SECTORS_PER_CLUSTER + 1;
 }
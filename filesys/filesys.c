@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/buffer_cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
@@ -12,6 +13,8 @@
 struct disk *filesys_disk;
 
 static void do_format (void);
+static bool inode_sector_allocate (disk_sector_t *);
+static void inode_sector_release (disk_sector_t);
 
 /* Initializes the file system module.
  * If FORMAT is true, reformats the file system. */
@@ -21,6 +24,7 @@ filesys_init (bool format) {
 	if (filesys_disk == NULL)
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
+	buffer_cache_init ();
 	inode_init ();
 
 #ifdef EFILESYS
@@ -51,6 +55,19 @@ filesys_done (void) {
 #else
 	free_map_close ();
 #endif
+	buffer_cache_done ();
+}
+
+/* Writes the allocation metadata that changed since the last call, and
+ * then every dirty cached sector, to disk. */
+void
+filesys_flush (void) {
+#ifdef EFILESYS
+	fat_flush ();
+#else
+	free_map_flush ();
+#endif
+	buffer_cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -60,13 +77,16 @@ filesys_done (void) {
 bool
 filesys_create (const char *name, off_t initial_size) {
 	disk_sector_t inode_sector = 0;
+	bool created = false;
 	struct dir *dir = dir_open_root ();
 	bool success = (dir != NULL
-			&& free_map_allocate (1, &inode_sector)
-			&& inode_create (inode_sector, initial_size)
+			&& inode_sector_allocate (&inode_sector)
+			&& (created = inode_create (inode_sector, initial_size))
 			&& dir_add (dir, name, inode_sector));
-	if (!success && inode_sector != 0)
-		free_map_release (inode_sector, 1);
+	if (!success && created)
+		inode_delete (inode_sector);
+	else if (!success && inode_sector != 0)
+		inode_sector_release (inode_sector);
 	dir_close (dir);
 
 	return success;
@@ -102,6 +122,29 @@ filesys_remove (const char *name) {
 	return success;
 }
 
+/* Creates a file of SIZE bytes, zeroed, with no name. It goes away
+ * when its last opener closes it, as a removed file does.
+ * Returns the new file if successful or a null pointer otherwise. */
+struct file *
+filesys_create_anonymous (off_t size) {
+	disk_sector_t inode_sector;
+	struct inode *inode;
+
+	if (!inode_sector_allocate (&inode_sector))
+		return NULL;
+	if (!inode_create (inode_sector, size)) {
+		inode_sector_release (inode_sector);
+		return NULL;
+	}
+	inode = inode_open (inode_sector);
+	if (inode == NULL) {
+		inode_delete (inode_sector);
+		return NULL;
+	}
+	inode_remove (inode);
+	return file_open (inode);
+}
+
 /* Formats the file system. */
 static void
 do_format (void) {
@@ -110,6 +153,8 @@ do_format (void) {
 #ifdef EFILESYS
 	/* Create FAT and save it to the disk. */
 	fat_create ();
+	if (!dir_create (ROOT_DIR_SECTOR, 16))
+		PANIC ("root directory creation failed");
 	fat_close ();
 #else
 	free_map_create ();
@@ -120,3 +165,29 @@ do_format (void) {
 
 	printf ("done.\n");
 }
+
+/* Allocates a sector for a new inode and stores it in *SECTORP.
+ * With the FAT, the inode lives in a cluster of its own.
+ * Returns true if successful, false if the disk is full. */
+static bool
+inode_sector_allocate (disk_sector_t *sectorp) {
+#ifdef EFILESYS
+	cluster_t clst = fat_create_chain (0);
+	if (clst == 0)
+		return false;
+	*sectorp = cluster_to_sector (clst);
+	return true;
+#else
+	return free_map_allocate (1, sectorp);
+#endif
+}
+
+/* Releases inode SECTOR, allocated by inode_sector_allocate(). */
+static void
+inode_sector_release (disk_sector_t sector) {
+#ifdef EFILESYS
+	fat_remove_chain (sector_to_cluster (sector), 0);
+#else
+	free_map_release (sector, 1);
+#endif
+}
@@ -1,12 +1,26 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <limits.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
+static struct bitmap *dirty_map;     /* Sectors of the free map file that
+                                        changed since the last flush. */
+
+/* Notes that the bits of the free map for the CNT sectors from SECTOR
+ * on changed, so that free_map_flush() writes the part of the file
+ * that holds them. */
+static void
+mark_dirty (disk_sector_t sector, size_t cnt) {
+	size_t first = sector / CHAR_BIT / DISK_SECTOR_SIZE;
+	size_t last = (sector + cnt - 1) / CHAR_BIT / DISK_SECTOR_SIZE;
+	bitmap_set_multiple (dirty_map, first, last - first + 1, true);
+}
 
 /* Initializes the free map. */
 void
@@ -14,6 +28,10 @@ free_map_init (void) {
 	free_map = bitmap_create (disk_size (filesys_disk));
 	if (free_map == NULL)
 		PANIC ("bitmap creation failed--disk is too large");
+	dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+				DISK_SECTOR_SIZE));
+	if (dirty_map == NULL)
+		PANIC ("bitmap creation failed--disk is too large");
 	bitmap_mark (free_map, FREE_MAP_SECTOR);
 	bitmap_mark (free_map, ROOT_DIR_SECTOR);
 }
@@ -25,15 +43,24 @@ free_map_init (void) {
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
 	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
-		bitmap_set_multiple (free_map, sector, cnt, false);
-		sector = BITMAP_ERROR;
-	}
-	if (sector != BITMAP_ERROR)
-		*sectorp = sector;
-	return sector != BITMAP_ERROR;
+	if (sector == BITMAP_ERROR)
+		return false;
+	mark_dirty (sector, cnt);
+	*sectorp = sector;
+	return true;
+}
+
+/* Allocates the CNT sectors starting at SECTOR, if they are all free,
+ * so that a file can grow in place.
+ * Returns true if successful. */
+bool
+free_map_allocate_at (disk_sector_t sector, size_t cnt) {
+	if (sector + cnt > bitmap_size (free_map)
+			|| !bitmap_none (free_map, sector, cnt))
+		return false;
+	bitmap_set_multiple (free_map, sector, cnt, true);
+	mark_dirty (sector, cnt);
+	return true;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
@@ -41,7 +68,31 @@ void
 free_map_release (disk_sector_t sector, size_t cnt) {
 	ASSERT (bitmap_all (free_map, sector, cnt));
 	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+	mark_dirty (sector, cnt);
+}
+
+/* Writes the sectors of the free map file that changed since the last
+ * flush, each run of consecutive ones in a single write. They go to the
+ * buffer cache, which puts them on disk with its next flush. */
+void
+free_map_flush (void) {
+	size_t start = 0;
+
+	if (free_map_file == NULL)
+		return;
+	while ((start = bitmap_scan (dirty_map, start, 1, true)) != BITMAP_ERROR) {
+		size_t end = bitmap_scan (dirty_map, start, 1, false);
+		if (end == BITMAP_ERROR)
+			end = bitmap_size (dirty_map);
+
+		/* Clear first, so that a change made during the write is
+		 * flushed next time. */
+		bitmap_set_multiple (dirty_map, start, end - start, false);
+		if (!bitmap_write_part (free_map, free_map_file,
+					start * DISK_SECTOR_SIZE, (end - start) * DISK_SECTOR_SIZE))
+			bitmap_set_multiple (dirty_map, start, end - start, true);
+		start = end;
+	}
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -57,7 +108,9 @@ free_map_open (void) {
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) {
+	free_map_flush ();
 	file_close (free_map_file);
+	free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -74,4 +127,5 @@ free_map_create (void) {
 		PANIC ("can't open free map");
 	if (!bitmap_write (free_map, free_map_file))
 		PANIC ("can't write free map");
+	bitmap_set_all (dirty_map, false);
 }
@@ -3,22 +3,72 @@
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/buffer_cache.h"
+#ifdef EFILESYS
+#include "filesys/fat.h"
+#endif
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#if defined (VM) && defined (EFILESYS)
+#include "filesys/page_cache.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+#ifdef EFILESYS
 /* On-disk inode.
  * Must be exactly DISK_SECTOR_SIZE bytes long. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t sector_cnt;                /* Number of data sectors. */
+	cluster_t start;                    /* First data cluster, or 0. */
+	cluster_t end;                      /* Last data cluster, or 0. */
+	uint32_t unused[123];               /* Not used. */
+};
+#else
+/* A run of consecutive sectors of a file, contiguous on disk. */
+struct extent {
+	uint32_t ofs;                       /* First file sector it holds. */
+	disk_sector_t start;                /* First disk sector. */
+	uint32_t length;                    /* Number of sectors. */
+};
+
+/* Number of extents in the inode, and in an indirect block, and number
+ * of indirect blocks in the doubly indirect block. The extents of a file
+ * are numbered in file order, through the three levels. */
+#define DIRECT_CNT 40
+#define INDIRECT_CNT 42
+#define DOUBLY_CNT 128
+
+/* On-disk inode.
+ * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct inode_disk {
+	off_t length;                       /* File size in bytes. */
+	unsigned magic;                     /* Magic number. */
+	uint32_t sector_cnt;                /* Number of data sectors. */
+	uint32_t extent_cnt;                /* Number of extents. */
+	disk_sector_t indirect;             /* Indirect block, or 0. */
+	disk_sector_t doubly_indirect;      /* Doubly indirect block, or 0. */
+	struct extent direct[DIRECT_CNT];   /* First extents. */
+	uint32_t unused[2];                 /* Not used. */
+};
+
+/* Indirect block: the next INDIRECT_CNT extents. */
+struct indirect_block {
+	struct extent extents[INDIRECT_CNT];
+	uint32_t unused[2];
 };
 
+/* Doubly indirect block: sectors of indirect blocks. */
+struct doubly_indirect_block {
+	disk_sector_t blocks[DOUBLY_CNT];
+};
+#endif
+
 /* Returns the number of sectors to allocate for an inode SIZE
  * bytes long. */
 static inline size_t
@@ -33,29 +83,327 @@ struct inode {
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	struct lock lock;                   /* Protects the members below. */
+#ifdef EFILESYS
+	size_t pos_idx;                     /* Cluster last looked up, by */
+	cluster_t pos_clst;                 /* index in the file, or 0. */
+#else
+	struct extent hint;                 /* Extent last looked up. */
+#endif
 	struct inode_disk data;             /* Inode content. */
 };
 
+/* Zeroes CNT sectors from SECTOR on. */
+static void
+zero_sectors (disk_sector_t sector, size_t cnt) {
+	static char zeros[DISK_SECTOR_SIZE];
+	size_t i;
+
+	for (i = 0; i < cnt; i++)
+		buffer_cache_write (sector + i, zeros, 0, DISK_SECTOR_SIZE);
+}
+
+#ifdef EFILESYS
+/* Adds SECTORS zeroed data sectors at the end of DISK_INODE, a cluster
+ * at a time. The FAT gives out the cluster right after the last one
+ * when it is free, so that the chain stays contiguous. Returns false if
+ * the disk is full; the clusters added so far are kept. */
+static bool
+inode_extend (struct inode_disk *disk_inode, size_t sectors) {
+	while (sectors > 0) {
+		cluster_t clst = fat_create_chain (disk_inode->end);
+		if (clst == 0)
+			return false;
+		zero_sectors (cluster_to_sector (clst), SECTORS_PER_CLUSTER);
+		if (disk_inode->start == 0)
+			disk_inode->start = clst;
+		disk_inode->end = clst;
+		disk_inode->sector_cnt += SECTORS_PER_CLUSTER;
+		sectors -= sectors < SECTORS_PER_CLUSTER ? sectors : SECTORS_PER_CLUSTER;
+	}
+	return true;
+}
+
+/* Releases the data clusters of DISK_INODE. */
+static void
+inode_release_sectors (const struct inode_disk *disk_inode) {
+	if (disk_inode->start != 0)
+		fat_remove_chain (disk_inode->start, 0);
+}
+
 /* Returns the disk sector that contains byte offset POS within
- * INODE.
+ * INODE, and stores in *RUN, if not null, the number of sectors from
+ * there on that are contiguous on disk.
  * Returns -1 if INODE does not contain data for a byte at offset
- * POS. */
+ * POS. The chain is walked from the cluster looked up last when POS
+ * is not before it, so sequential access costs O(1) and a seek costs
+ * the distance from there. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) {
+byte_to_sector (struct inode *inode, off_t pos, size_t *run) {
+	size_t sector = pos / DISK_SECTOR_SIZE;
+	size_t idx = sector / SECTORS_PER_CLUSTER;
+	cluster_t clst;
+	size_t i = 0;
+
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
-	else
+	lock_acquire (&inode->lock);
+	if (pos >= inode->data.length) {
+		lock_release (&inode->lock);
 		return -1;
+	}
+
+	clst = inode->data.start;
+	if (inode->pos_clst != 0 && inode->pos_idx <= idx) {
+		i = inode->pos_idx;
+		clst = inode->pos_clst;
+	}
+	for (; i < idx; i++)
+		clst = fat_get (clst);
+	inode->pos_idx = idx;
+	inode->pos_clst = clst;
+	lock_release (&inode->lock);
+
+	if (run != NULL) {
+		size_t cnt = 1;
+		cluster_t next = clst;
+		while (cnt < DISK_MAX_SECTORS / SECTORS_PER_CLUSTER
+				&& fat_get (next) == next + 1) {
+			next++;
+			cnt++;
+		}
+		*run = cnt * SECTORS_PER_CLUSTER - sector % SECTORS_PER_CLUSTER;
+	}
+	return cluster_to_sector (clst) + sector % SECTORS_PER_CLUSTER;
+}
+
+#else
+/* Reads extent IDX of DISK_INODE into *E. */
+static void
+extent_read (const struct inode_disk *disk_inode, size_t idx,
+		struct extent *e) {
+	disk_sector_t block;
+
+	ASSERT (idx < disk_inode->extent_cnt);
+	if (idx < DIRECT_CNT) {
+		*e = disk_inode->direct[idx];
+		return;
+	}
+	idx -= DIRECT_CNT;
+	if (idx < INDIRECT_CNT)
+		block = disk_inode->indirect;
+	else {
+		idx -= INDIRECT_CNT;
+		buffer_cache_read (disk_inode->doubly_indirect, &block,
+				idx / INDIRECT_CNT * sizeof block, sizeof block);
+		idx %= INDIRECT_CNT;
+	}
+	buffer_cache_read (block, e, idx * sizeof *e, sizeof *e);
+}
+
+/* Allocates a zeroed block for extents into *SECTORP, unless there is
+ * one already. */
+static bool
+extent_block_alloc (disk_sector_t *sectorp) {
+	static char zeros[DISK_SECTOR_SIZE];
+
+	if (*sectorp != 0)
+		return true;
+	if (!free_map_allocate (1, sectorp))
+		return false;
+	buffer_cache_write (*sectorp, zeros, 0, DISK_SECTOR_SIZE);
+	return true;
+}
+
+/* Writes E as extent IDX of DISK_INODE, which has at least IDX extents,
+ * allocating the blocks it goes in. Returns false if they cannot be. */
+static bool
+extent_write (struct inode_disk *disk_inode, size_t idx,
+		const struct extent *e) {
+	disk_sector_t block;
+
+	if (idx < DIRECT_CNT) {
+		disk_inode->direct[idx] = *e;
+		return true;
+	}
+	idx -= DIRECT_CNT;
+	if (idx < INDIRECT_CNT) {
+		if (!extent_block_alloc (&disk_inode->indirect))
+			return false;
+		block = disk_inode->indirect;
+	} else {
+		off_t block_ofs;
+
+		idx -= INDIRECT_CNT;
+		if (idx / INDIRECT_CNT >= DOUBLY_CNT
+				|| !extent_block_alloc (&disk_inode->doubly_indirect))
+			return false;
+		block_ofs = idx / INDIRECT_CNT * sizeof block;
+		buffer_cache_read (disk_inode->doubly_indirect, &block,
+				block_ofs, sizeof block);
+		if (block == 0) {
+			if (!extent_block_alloc (&block))
+				return false;
+			buffer_cache_write (disk_inode->doubly_indirect, &block,
+					block_ofs, sizeof block);
+		}
+		idx %= INDIRECT_CNT;
+	}
+	buffer_cache_write (block, e, idx * sizeof *e, sizeof *e);
+	return true;
+}
+
+/* Adds SECTORS zeroed data sectors at the end of DISK_INODE. The last
+ * extent grows in place when the sectors after it are free; otherwise
+ * the new sectors go in as few new extents as the free map allows.
+ * Returns false if the disk or the extent map is full; the sectors
+ * added so far are kept. */
+static bool
+inode_extend (struct inode_disk *disk_inode, size_t sectors) {
+	while (sectors > 0) {
+		struct extent e;
+		size_t cnt;
+
+		if (disk_inode->extent_cnt > 0) {
+			extent_read (disk_inode, disk_inode->extent_cnt - 1, &e);
+			for (cnt = sectors; cnt > 0; cnt /= 2)
+				if (free_map_allocate_at (e.start + e.length, cnt))
+					break;
+			if (cnt > 0) {
+				zero_sectors (e.start + e.length, cnt);
+				e.length += cnt;
+				extent_write (disk_inode, disk_inode->extent_cnt - 1, &e);
+				disk_inode->sector_cnt += cnt;
+				sectors -= cnt;
+				continue;
+			}
+		}
+
+		for (cnt = sectors; cnt > 0; cnt /= 2)
+			if (free_map_allocate (cnt, &e.start))
+				break;
+		if (cnt == 0)
+			return false;
+		e.ofs = disk_inode->sector_cnt;
+		e.length = cnt;
+		if (!extent_write (disk_inode, disk_inode->extent_cnt, &e)) {
+			free_map_release (e.start, cnt);
+			return false;
+		}
+		zero_sectors (e.start, cnt);
+		disk_inode->extent_cnt++;
+		disk_inode->sector_cnt += cnt;
+		sectors -= cnt;
+	}
+	return true;
+}
+
+/* Releases the data sectors and extent blocks of DISK_INODE. */
+static void
+inode_release_sectors (const struct inode_disk *disk_inode) {
+	size_t i;
+
+	for (i = 0; i < disk_inode->extent_cnt; i++) {
+		struct extent e;
+		extent_read (disk_inode, i, &e);
+		free_map_release (e.start, e.length);
+	}
+	if (disk_inode->indirect != 0)
+		free_map_release (disk_inode->indirect, 1);
+	if (disk_inode->doubly_indirect != 0) {
+		for (i = 0; i < DOUBLY_CNT; i++) {
+			disk_sector_t block;
+			buffer_cache_read (disk_inode->doubly_indirect, &block,
+					i * sizeof block, sizeof block);
+			if (block != 0)
+				free_map_release (block, 1);
+		}
+		free_map_release (disk_inode->doubly_indirect, 1);
+	}
+}
+
+/* Returns the disk sector that contains byte offset POS within
+ * INODE, and stores in *RUN, if not null, the number of sectors from
+ * there on that are contiguous on disk.
+ * Returns -1 if INODE does not contain data for a byte at offset
+ * POS. The extent is found by binary search, unless it is the one
+ * found last. */
+static disk_sector_t
+byte_to_sector (struct inode *inode, off_t pos, size_t *run) {
+	const struct inode_disk *disk_inode = &inode->data;
+	uint32_t sector = pos / DISK_SECTOR_SIZE;
+	struct extent e;
+
+	ASSERT (inode != NULL);
+	lock_acquire (&inode->lock);
+	if (pos >= disk_inode->length) {
+		lock_release (&inode->lock);
+		return -1;
+	}
+
+	e = inode->hint;
+	if (sector < e.ofs || sector >= e.ofs + e.length) {
+		/* Last extent starting at or before SECTOR. */
+		size_t lo = 0, hi = disk_inode->extent_cnt;
+		while (hi - lo > 1) {
+			size_t mid = (lo + hi) / 2;
+			extent_read (disk_inode, mid, &e);
+			if (e.ofs <= sector)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		extent_read (disk_inode, lo, &e);
+		ASSERT (sector >= e.ofs && sector < e.ofs + e.length);
+		inode->hint = e;
+	}
+	lock_release (&inode->lock);
+
+	if (run != NULL)
+		*run = e.ofs + e.length - sector;
+	return e.start + (sector - e.ofs);
+}
+#endif
+
+/* Grows INODE to LENGTH bytes, zero-filled. If the disk fills up, it
+ * grows over the sectors it could get, and returns false. */
+static bool
+inode_grow (struct inode *inode, off_t length) {
+	size_t sectors = bytes_to_sectors (length);
+	bool success = true;
+
+	lock_acquire (&inode->lock);
+	if (length <= inode->data.length) {
+		/* Another writer grew it meanwhile. */
+		lock_release (&inode->lock);
+		return true;
+	}
+	if (sectors > inode->data.sector_cnt
+			&& !inode_extend (&inode->data, sectors - inode->data.sector_cnt)) {
+		off_t allocated = inode->data.sector_cnt * DISK_SECTOR_SIZE;
+		if (length > allocated)
+			length = allocated;
+		success = false;
+	}
+	if (length > inode->data.length)
+		inode->data.length = length;
+	buffer_cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+	lock_release (&inode->lock);
+	return success;
 }
 
 /* List of open inodes, so that opening a single inode twice
  * returns the same `struct inode'. */
 static struct list open_inodes;
 
+static void inode_free (disk_sector_t, const struct inode_disk *);
+
 /* Initializes the inode module. */
 void
 inode_init (void) {
+#ifndef EFILESYS
+	ASSERT (sizeof (struct indirect_block) == DISK_SECTOR_SIZE);
+	ASSERT (sizeof (struct doubly_indirect_block) == DISK_SECTOR_SIZE);
+#endif
 	list_init (&open_inodes);
 }
 
@@ -77,20 +425,13 @@ inode_create (disk_sector_t sector, off_t length) {
 
 	disk_inode = calloc (1, sizeof *disk_inode);
 	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
 		disk_inode->length = length;
 		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
+		if (inode_extend (disk_inode, bytes_to_sectors (length))) {
+			buffer_cache_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
 			success = true; 
-		} 
+		} else
+			inode_release_sectors (disk_inode);
 		free (disk_inode);
 	}
 	return success;
@@ -125,7 +466,13 @@ inode_open (disk_sector_t sector) {
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	lock_init (&inode->lock);
+#ifdef EFILESYS
+	inode->pos_clst = 0;
+#else
+	inode->hint.length = 0;
+#endif
+	buffer_cache_read (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
 	return inode;
 }
 
@@ -157,17 +504,42 @@ inode_close (struct inode *inode) {
 		/* Remove from inode list and release lock. */
 		list_remove (&inode->elem);
 
+#if defined (VM) && defined (EFILESYS)
+		/* Write back, or drop, its pages in the page cache. */
+		page_cache_release (inode, inode->removed);
+#endif
+
 		/* Deallocate blocks if removed. */
-		if (inode->removed) {
-			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
-		}
+		if (inode->removed)
+			inode_free (inode->sector, &inode->data);
 
 		free (inode); 
 	}
 }
 
+/* Deletes the inode at SECTOR, created by inode_create() but never
+ * opened, freeing its blocks. */
+void
+inode_delete (disk_sector_t sector) {
+	struct inode_disk disk_inode;
+
+	buffer_cache_read (sector, &disk_inode, 0, DISK_SECTOR_SIZE);
+	ASSERT (disk_inode.magic == INODE_MAGIC);
+	inode_free (sector, &disk_inode);
+}
+
+/* Frees the inode at SECTOR and the data sectors of DISK_INODE, its
+ * content. */
+static void
+inode_free (disk_sector_t sector, const struct inode_disk *disk_inode) {
+#ifdef EFILESYS
+	fat_remove_chain (sector_to_cluster (sector), 0);
+#else
+	free_map_release (sector, 1);
+#endif
+	inode_release_sectors (disk_inode);
+}
+
 /* Marks INODE to be deleted when it is closed by the last caller who
  * has it open. */
 void
@@ -180,14 +552,47 @@ inode_remove (struct inode *inode) {
  * Returns the number of bytes actually read, which may be less
  * than SIZE if an error occurs or end of file is reached. */
 off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) {
+#if defined (VM) && defined (EFILESYS)
+	return page_cache_read (inode, buffer, size, offset);
+#else
+	return inode_read_direct (inode, buffer, size, offset);
+#endif
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+ * Returns the number of bytes actually written, which may be
+ * less than SIZE if the disk is full or an error occurs.
+ * A write past end of file extends the inode, zero-filling any gap. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+		off_t offset) {
+	if (inode->deny_write_cnt)
+		return 0;
+
+	/* If growth stops short, write what fits. */
+	if (size > 0 && offset + size > inode_length (inode))
+		inode_grow (inode, offset + size);
+
+#if defined (VM) && defined (EFILESYS)
+	return page_cache_write (inode, buffer, size, offset);
+#else
+	return inode_write_direct (inode, buffer, size, offset);
+#endif
+}
+
+/* Like inode_read_at, but bypassing the page cache, which fills its
+ * pages with it. */
+off_t
+inode_read_direct (struct inode *inode, void *buffer_, off_t size,
+		off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
 
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		size_t run;
+		disk_sector_t sector_idx = byte_to_sector (inode, offset, &run);
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -201,48 +606,40 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 			break;
 
 		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+			/* Read whole sectors contiguous on disk at once. */
+			size_t cnt = (inode_left < size ? inode_left : size)
+				/ DISK_SECTOR_SIZE;
+			if (cnt > run)
+				cnt = run;
+			if (cnt > DISK_MAX_SECTORS)
+				cnt = DISK_MAX_SECTORS;
+			buffer_cache_read_multiple (sector_idx, buffer + bytes_read, cnt);
+			chunk_size = cnt * DISK_SECTOR_SIZE;
+		} else
+			buffer_cache_read (sector_idx, buffer + bytes_read,
+					sector_ofs, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
- * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+/* Like inode_write_at, but bypassing the page cache, which writes its
+ * pages back with it. Writes are not denied: a page written before the
+ * inode was denied writes still has to reach the disk. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_direct (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
-
-	if (inode->deny_write_cnt)
-		return 0;
 
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		disk_sector_t sector_idx = byte_to_sector (inode, offset, NULL);
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -255,34 +652,16 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
-		}
+		/* The cache reads the sector in first unless the chunk
+		 * covers all of it. */
+		buffer_cache_write (sector_idx, buffer + bytes_written,
+				sector_ofs, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
 
 	return bytes_written;
 }
@@ -1,9 +1,59 @@
-/* page_cache.c: Implementation of Page Cache (Buffer Cache). */
+/* page_cache.c: Implementation of Page Cache (Buffer Cache).
+ *
+ * File data is cached a page at a time in VM_PAGE_CACHE pages, whose
+ * frames come from the user pool like those of any other page: the
+ * eviction hand reclaims cached file data and anonymous memory from one
+ * pool, and the writeback daemon cleans both. A cached page is mapped at
+ * a slot address of pc_pml4, an address space of its own that is never
+ * activated, so that eviction finds its accessed and dirty bits where it
+ * finds those of any other page. Accesses go through the kva and set the
+ * bits by hand.
+ *
+ * inode_read_at and inode_write_at go through the cache, which fills and
+ * writes back pages with inode_read_direct and inode_write_direct. An
+ * evicted page stays in the index without a frame, and is swapped back
+ * in on its next access, until kworkerd sweeps it.
+ *
+ * kworkerd reads ahead the windows sequential readers queue, and writes
+ * dirty pages back every PAGE_CACHE_FLUSH_INTERVAL ticks, or on each pass
+ * while free frames are below the writeback daemon's low watermark. */
 
 #include "vm/vm.h"
+#if defined (VM) && defined (EFILESYS)
+#include <bitmap.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
+#include "vm/writeback.h"
+
+/* Address of the first slot in pc_pml4. */
+#define PAGE_CACHE_BASE ((void *) 0x10000000)
+
+/* Pages read ahead in one window. */
+#define READAHEAD_PAGES 8
+
+/* Maximum number of windows waiting for kworkerd. */
+#define READAHEAD_QUEUE 16
+
+/* Ticks between two flushes of the dirty pages. */
+#define PAGE_CACHE_FLUSH_INTERVAL (5 * TIMER_FREQ)
+
+/* Ticks between two passes of kworkerd. */
+#define KWORKERD_INTERVAL 2
+
+/* Pages written back, or swept, in one pass when there is no memory
+ * to collect them all. */
+#define PAGE_CACHE_BATCH 16
+
 static bool page_cache_readahead (struct page *page, void *kva);
 static bool page_cache_writeback (struct page *page);
 static void page_cache_destroy (struct page *page);
+static void page_cache_kworkerd (void *aux);
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations page_cache_op = {
@@ -15,36 +65,561 @@ static const struct page_operations page_cache_op = {
 
 tid_t page_cache_workerd;
 
+/* A readahead window, from the page at OFS. */
+struct readahead {
+	struct inode *inode;
+	off_t ofs;
+	struct list_elem elem;
+};
+
+/* pc_lock protects the index, the slots, the readahead queue and the
+ * page_cache member of the cached pages. It is taken before the frame
+ * lock, never after, and never held across I/O. */
+static struct lock pc_lock;
+static struct hash pc_index;		/* Cached pages, by inode and offset. */
+static struct bitmap *pc_slots;		/* Slot addresses in use. */
+static uint64_t *pc_pml4;			/* Where cached pages are mapped. */
+static struct list ra_requests;		/* Windows to read ahead, oldest first. */
+static struct inode *ra_inode;		/* Inode kworkerd is reading ahead. */
+static struct condition ra_idle;	/* Signaled when ra_inode is cleared. */
+static bool pc_ready;
+
+/* Statistics. */
+static long long access_cnt;		/* Number of page accesses. */
+static long long miss_cnt;			/* Of those, read from the file. */
+static long long readahead_cnt;		/* Number of pages read ahead. */
+static long long writeback_cnt;		/* Number of pages written back. */
+
+static uint64_t
+pc_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page_cache *pc = hash_entry (e, struct page_cache, elem);
+	return hash_bytes (&pc->inode, sizeof pc->inode) ^ hash_int (pc->ofs);
+}
+
+static bool
+pc_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct page_cache *a = hash_entry (a_, struct page_cache, elem);
+	const struct page_cache *b = hash_entry (b_, struct page_cache, elem);
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->ofs < b->ofs;
+}
+
 /* The initializer of file vm */
 void
 pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+	lock_init (&pc_lock);
+	cond_init (&ra_idle);
+	list_init (&ra_requests);
+	hash_init (&pc_index, pc_hash, pc_less, NULL);
+	pc_slots = bitmap_create (2 * palloc_user_page_cnt ());
+	pc_pml4 = pml4_create ();
+	if (pc_slots == NULL || pc_pml4 == NULL)
+		PANIC ("pagecache_init: out of memory");
+	page_cache_workerd = thread_create ("kworkerd", PRI_DEFAULT,
+			page_cache_kworkerd, NULL);
+	pc_ready = true;
 }
 
 /* Initialize the page cache */
 bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
+page_cache_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &page_cache_op;
+	return true;
+}
+
+/* Returns the cached page of INODE at OFS. pc_lock must be held. */
+static struct page *
+pc_find (struct inode *inode, off_t ofs) {
+	struct page_cache key;
+	struct hash_elem *e;
+
+	key.inode = inode;
+	key.ofs = ofs;
+	e = hash_find (&pc_index, &key.elem);
+	return e != NULL ? hash_entry (e, struct page, page_cache.elem) : NULL;
+}
+
+/* Returns the page of INODE at OFS, creating it without a frame if it is
+ * not cached, and holds it. Returns NULL if no slot or memory is left.
+ * pc_lock must be held. */
+static struct page *
+pc_get (struct inode *inode, off_t ofs) {
+	struct page *page = pc_find (inode, ofs);
+	size_t slot;
+
+	if (page == NULL) {
+		slot = bitmap_scan_and_flip (pc_slots, 0, 1, false);
+		if (slot == BITMAP_ERROR)
+			return NULL;
+		page = calloc (1, sizeof *page);
+		if (page == NULL) {
+			bitmap_reset (pc_slots, slot);
+			return NULL;
+		}
+		page_cache_initializer (page, VM_PAGE_CACHE, NULL);
+		page->va = PAGE_CACHE_BASE + slot * PGSIZE;
+		page->pml4 = pc_pml4;
+		page->writable = true;
+		page->page_cache.inode = inode;
+		page->page_cache.ofs = ofs;
+		hash_insert (&pc_index, &page->page_cache.elem);
+	}
+	page->page_cache.users++;
+	return page;
+}
+
+/* Queues the readahead window of INODE from OFS, if OFS is in the file.
+ * pc_lock must be held. */
+static void
+pc_queue_readahead (struct inode *inode, off_t ofs) {
+	struct readahead *ra;
+
+	if (ofs >= inode_length (inode)
+			|| list_size (&ra_requests) >= READAHEAD_QUEUE)
+		return;
+	ra = malloc (sizeof *ra);
+	if (ra == NULL)
+		return;
+	ra->inode = inode;
+	ra->ofs = ofs;
+	list_push_back (&ra_requests, &ra->elem);
+}
+
+/* Returns PAGE's frame, pinned, swapping PAGE in first if it has none.
+ * Returns NULL if no frame can be had, or the read fails. An evictor
+ * writing a file page back must not evict in turn, so it only gets
+ * resident pages. */
+static struct frame *
+pc_pin (struct page *page) {
+	for (;;) {
+		struct frame *frame = vm_pin_page_frame (page);
+		bool success;
+
+		if (frame != NULL)
+			return frame;
+		if (lock_held_by_current_thread (&evict_lock))
+			return NULL;
+		frame = vm_get_frame ();
+		if (frame == NULL)
+			return NULL;
+
+		lock_acquire (&frame_lock);
+		if (page->frame != NULL || page->busy) {
+			/* Someone else swapped it in meanwhile. */
+			lock_release (&frame_lock);
+			vm_free_frame (frame);
+			continue;
+		}
+		frame->page = page;
+		page->frame = frame;
+		vm_frame_set_busy (frame, true);
+		lock_release (&frame_lock);
+
+		success = swap_in (page, frame->kva);
+
+		lock_acquire (&frame_lock);
+		if (success)
+			success = pml4_set_page (pc_pml4, page->va, frame->kva, true);
+		if (!success) {
+			page->frame = NULL;
+			frame->page = NULL;
+		}
+		vm_frame_set_busy (frame, false);
+		lock_release (&frame_lock);
+		if (!success) {
+			vm_free_frame (frame);
+			return NULL;
+		}
+		return frame;
+	}
+}
+
+/* Writes PAGE, at KVA, back to its file. Returns false on error. */
+static bool
+pc_write_back (struct page *page, void *kva) {
+	struct page_cache *pc = &page->page_cache;
+	off_t bytes = inode_length (pc->inode) - pc->ofs;
+
+	if (bytes > PGSIZE)
+		bytes = PGSIZE;
+	if (bytes <= 0)
+		return true;
+	writeback_cnt++;
+	return inode_write_direct (pc->inode, kva, bytes, pc->ofs) == bytes;
+}
+
+/* Copies SIZE bytes between BUFFER and INODE at OFFSET through the
+ * cache. Pages that cannot be cached go straight to the file. */
+static off_t
+page_cache_io (struct inode *inode, void *buffer_, off_t size, off_t offset,
+		bool write) {
+	uint8_t *buffer = buffer_;
+	off_t bytes_done = 0;
+
+	while (size > 0) {
+		/* Page to access, starting byte offset within page. */
+		off_t page_ofs = ROUND_DOWN (offset, PGSIZE);
+		int ofs_in_page = offset - page_ofs;
+
+		/* Bytes left in inode, bytes left in page, lesser of the two. */
+		off_t inode_left = inode_length (inode) - offset;
+		int page_left = PGSIZE - ofs_in_page;
+		int min_left = inode_left < page_left ? inode_left : page_left;
+
+		/* Number of bytes to actually copy. */
+		int chunk_size = size < min_left ? size : min_left;
+		struct page *page;
+		struct frame *frame;
+		if (chunk_size <= 0)
+			break;
+
+		lock_acquire (&pc_lock);
+		page = pc_get (inode, page_ofs);
+		if (page != NULL && page->page_cache.ra_mark) {
+			/* A reader reached the last window: queue the next one. */
+			page->page_cache.ra_mark = false;
+			pc_queue_readahead (inode, page_ofs + READAHEAD_PAGES * PGSIZE);
+		}
+		access_cnt++;
+		lock_release (&pc_lock);
+
+		frame = page != NULL ? pc_pin (page) : NULL;
+		if (frame == NULL && page != NULL) {
+			/* Keep the page from being read in while the file changes
+			 * under it, or retry if it got a frame meanwhile. */
+			bool direct;
+			lock_acquire (&frame_lock);
+			direct = vm_page_set_busy (page, true);
+			lock_release (&frame_lock);
+			if (!direct) {
+				lock_acquire (&pc_lock);
+				page->page_cache.users--;
+				lock_release (&pc_lock);
+				continue;
+			}
+		}
+		if (frame != NULL) {
+			if (write) {
+				memcpy (frame->kva + ofs_in_page, buffer + bytes_done, chunk_size);
+				pml4_set_dirty (pc_pml4, page->va, true);
+			} else
+				memcpy (buffer + bytes_done, frame->kva + ofs_in_page, chunk_size);
+			pml4_set_accessed (pc_pml4, page->va, true);
+			vm_unpin_frame (frame->kva);
+		} else {
+			/* The page is not resident: the file is up to date. */
+			off_t bytes = write
+				? inode_write_direct (inode, buffer + bytes_done, chunk_size, offset)
+				: inode_read_direct (inode, buffer + bytes_done, chunk_size, offset);
+			if (bytes != chunk_size)
+				chunk_size = 0;
+			if (page != NULL) {
+				lock_acquire (&frame_lock);
+				vm_page_set_busy (page, false);
+				lock_release (&frame_lock);
+			}
+		}
+
+		if (page != NULL) {
+			lock_acquire (&pc_lock);
+			page->page_cache.users--;
+			lock_release (&pc_lock);
+		}
+		if (chunk_size == 0)
+			break;
+
+		/* Advance. */
+		size -= chunk_size;
+		offset += chunk_size;
+		bytes_done += chunk_size;
+	}
+	return bytes_done;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at OFFSET, through
+ * the cache. */
+off_t
+page_cache_read (struct inode *inode, void *buffer, off_t size,
+		off_t offset) {
+	if (!pc_ready)
+		return inode_read_direct (inode, buffer, size, offset);
+	return page_cache_io (inode, buffer, size, offset, false);
+}
 
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET, through
+ * the cache. The data reaches the file later. Writes stop at end of
+ * file. */
+off_t
+page_cache_write (struct inode *inode, const void *buffer, off_t size,
+		off_t offset) {
+	if (!pc_ready)
+		return inode_write_direct (inode, buffer, size, offset);
+	return page_cache_io (inode, (void *) buffer, size, offset, true);
 }
 
 /* Utilze the Swap in mechanism to implement readhead */
 static bool
 page_cache_readahead (struct page *page, void *kva) {
+	struct page_cache *pc = &page->page_cache;
+	off_t bytes = inode_length (pc->inode) - pc->ofs;
+
+	if (bytes > PGSIZE)
+		bytes = PGSIZE;
+	if (bytes < 0)
+		bytes = 0;
+	if (inode_read_direct (pc->inode, kva, bytes, pc->ofs) != bytes)
+		return false;
+	memset (kva + bytes, 0, PGSIZE - bytes);
+
+	if (thread_current ()->tid == page_cache_workerd) {
+		readahead_cnt++;
+		return true;
+	}
+
+	/* A miss right after the previous page starts a readahead. */
+	lock_acquire (&pc_lock);
+	miss_cnt++;
+	if (pc->ofs == 0 || pc_find (pc->inode, pc->ofs - PGSIZE) != NULL)
+		pc_queue_readahead (pc->inode, pc->ofs + PGSIZE);
+	lock_release (&pc_lock);
+	return true;
 }
 
 /* Utilze the Swap out mechanism to implement writeback */
 static bool
 page_cache_writeback (struct page *page) {
+	/* The evictor took the dirty bit when it unmapped the page. */
+	if (vm_phys_frame (page->frame->kva)->dirty)
+		return pc_write_back (page, page->frame->kva);
+	return true;
+}
+
+/* Write resident PAGE back to its file, leaving it cached. Returns true
+ * if a write was done. PAGE must be busy. */
+bool
+page_cache_clean (struct page *page) {
+	/* Clear first: a write racing with the file write dirties it again. */
+	if (!vm_frame_test_and_clear_dirty (page->frame))
+		return false;
+	pc_write_back (page, page->frame->kva);
+	return true;
 }
 
 /* Destory the page_cache. */
 static void
 page_cache_destroy (struct page *page) {
+	lock_acquire (&pc_lock);
+	bitmap_reset (pc_slots, (page->va - PAGE_CACHE_BASE) / PGSIZE);
+	lock_release (&pc_lock);
+}
+
+/* Drops the cached pages of INODE, whose last opener is closing it,
+ * writing the dirty ones back unless DISCARD. */
+void
+page_cache_release (struct inode *inode, bool discard) {
+	struct list_elem *e;
+	off_t ofs;
+
+	if (!pc_ready)
+		return;
+
+	lock_acquire (&pc_lock);
+	for (e = list_begin (&ra_requests); e != list_end (&ra_requests); ) {
+		struct readahead *ra = list_entry (e, struct readahead, elem);
+		if (ra->inode == inode) {
+			e = list_remove (e);
+			free (ra);
+		} else
+			e = list_next (e);
+	}
+	while (ra_inode == inode)
+		cond_wait (&ra_idle, &pc_lock);
+
+	for (ofs = 0; ofs < inode_length (inode); ofs += PGSIZE) {
+		struct page *page = pc_find (inode, ofs);
+		struct frame *frame;
+		if (page == NULL)
+			continue;
+		hash_delete (&pc_index, &page->page_cache.elem);
+		lock_release (&pc_lock);
+
+		/* Waits for an eviction or a writeback in flight. */
+		frame = vm_pin_page_frame (page);
+		if (frame != NULL) {
+			if (!discard && pml4_is_dirty (pc_pml4, page->va))
+				pc_write_back (page, frame->kva);
+			pml4_clear_page (pc_pml4, page->va);
+			vm_free_frame (frame);
+		}
+		vm_dealloc_page (page);
+		lock_acquire (&pc_lock);
+	}
+	lock_release (&pc_lock);
+}
+
+/* Reads ahead the queued windows, as long as free frames are above the
+ * writeback daemon's low watermark. Each window marks its first page,
+ * and the reader that gets there queues the next window. */
+static void
+pc_readahead_run (void) {
+	lock_acquire (&pc_lock);
+	while (!list_empty (&ra_requests)) {
+		struct readahead *ra = list_entry (list_pop_front (&ra_requests),
+				struct readahead, elem);
+		off_t end = ra->ofs + READAHEAD_PAGES * PGSIZE;
+		off_t ofs;
+
+		ra_inode = ra->inode;
+		for (ofs = ra->ofs; ofs < end && ofs < inode_length (ra->inode);
+				ofs += PGSIZE) {
+			struct page *page;
+			struct frame *frame;
+
+			if (palloc_user_free_cnt () < writeback_low_pages)
+				break;
+			page = pc_get (ra->inode, ofs);
+			if (page == NULL)
+				break;
+			lock_release (&pc_lock);
+			frame = pc_pin (page);
+			if (frame != NULL)
+				vm_unpin_frame (frame->kva);
+			lock_acquire (&pc_lock);
+			if (ofs == ra->ofs)
+				page->page_cache.ra_mark = true;
+			page->page_cache.users--;
+			if (frame == NULL)
+				break;
+		}
+		ra_inode = NULL;
+		cond_broadcast (&ra_idle, &pc_lock);
+		free (ra);
+	}
+	lock_release (&pc_lock);
+}
+
+/* Collects the cached pages TAKE accepts into an array, in a single pass
+ * over the index, and stores their number in *CNT. Returns the array,
+ * allocated, or BATCH, which holds PAGE_CACHE_BATCH pages, if memory is
+ * short; the scan then stops once it is full, and the rest waits for the
+ * next pass. pc_lock and frame_lock must be held. */
+static struct page **
+pc_collect (bool (*take) (struct page *), struct page *batch[], size_t *cnt) {
+	size_t max = hash_size (&pc_index);
+	struct page **pages = NULL;
+	struct hash_iterator i;
+
+	if (max > PAGE_CACHE_BATCH)
+		pages = malloc (max * sizeof *pages);
+	if (pages == NULL) {
+		pages = batch;
+		if (max > PAGE_CACHE_BATCH)
+			max = PAGE_CACHE_BATCH;
+	}
+
+	*cnt = 0;
+	hash_first (&i, &pc_index);
+	while (*cnt < max && hash_next (&i)) {
+		struct page *page = hash_entry (hash_cur (&i), struct page,
+				page_cache.elem);
+		if (take (page))
+			pages[(*cnt)++] = page;
+	}
+	return pages;
+}
+
+/* Takes PAGE for pc_flush if it is dirty and not in use, and makes it
+ * busy, so that neither eviction nor an access touches it until it is
+ * written. */
+static bool
+pc_flush_take (struct page *page) {
+	if (page->frame == NULL || page->busy
+			|| vm_phys_frame (page->frame->kva)->pin_cnt > 0
+			|| !pml4_is_dirty (pc_pml4, page->va))
+		return false;
+	vm_frame_set_busy (page->frame, true);
+	return true;
+}
+
+/* Writes back every dirty page not in use. The writes are done without
+ * locks, and each page is released as soon as it is written. */
+static void
+pc_flush (void) {
+	struct page *batch[PAGE_CACHE_BATCH];
+	struct page **pages;
+	size_t cnt, j;
+
+	lock_acquire (&pc_lock);
+	lock_acquire (&frame_lock);
+	pages = pc_collect (pc_flush_take, batch, &cnt);
+	lock_release (&frame_lock);
+	lock_release (&pc_lock);
+
+	for (j = 0; j < cnt; j++) {
+		page_cache_clean (pages[j]);
+		lock_acquire (&frame_lock);
+		vm_frame_set_busy (pages[j]->frame, false);
+		lock_release (&frame_lock);
+	}
+	if (pages != batch)
+		free (pages);
+}
+
+/* Takes PAGE for pc_sweep if eviction left it without a frame and no
+ * one holds it. */
+static bool
+pc_sweep_take (struct page *page) {
+	return page->frame == NULL && !page->busy
+		&& page->page_cache.users == 0;
+}
+
+/* Frees the pages eviction left without a frame. */
+static void
+pc_sweep (void) {
+	struct page *batch[PAGE_CACHE_BATCH];
+	struct page **pages;
+	size_t cnt, j;
+
+	lock_acquire (&pc_lock);
+	lock_acquire (&frame_lock);
+	pages = pc_collect (pc_sweep_take, batch, &cnt);
+	lock_release (&frame_lock);
+	for (j = 0; j < cnt; j++)
+		hash_delete (&pc_index, &pages[j]->page_cache.elem);
+	lock_release (&pc_lock);
+
+	for (j = 0; j < cnt; j++)
+		vm_dealloc_page (pages[j]);
+	if (pages != batch)
+		free (pages);
 }
 
 /* Worker thread for page cache */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_kworkerd (void *aux UNUSED) {
+	int64_t last_flush = timer_ticks ();
+
+	for (;;) {
+		pc_readahead_run ();
+		if (timer_elapsed (last_flush) >= PAGE_CACHE_FLUSH_INTERVAL
+				|| palloc_user_free_cnt () < writeback_low_pages) {
+			pc_flush ();
+			pc_sweep ();
+			last_flush = timer_ticks ();
+		}
+		timer_sleep (KWORKERD_INTERVAL);
+	}
+}
+
+/* Prints page cache statistics. */
+void
+page_cache_print_stats (void) {
+	printf ("Page cache: %lld hits, %lld misses, %lld pages read ahead, "
+			"%lld pages written back\n", access_cnt - miss_cnt, miss_cnt,
+			readahead_cnt, writeback_cnt);
 }
+#endif /* VM && EFILESYS */
@@ -1,12 +1,28 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
-#include "vm/vm.h"
+#include <hash.h>
+#include <stdbool.h>
+#include "filesys/off_t.h"
 
+struct inode;
 struct page;
 enum vm_type;
 
-struct page_cache {};
+/* A page of file data in the page cache. */
+struct page_cache {
+	struct inode *inode;	/* Cached file */
+	off_t ofs;				/* Offset of the page in it */
+	int users;				/* Threads holding the page, not swept while positive */
+	bool ra_mark;			/* First page of a readahead window */
+	struct hash_elem elem;	/* Element in the cache index */
+};
 
-void page_cache_init (void);
+void pagecache_init (void);
 bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+off_t page_cache_read (struct inode *, void *, off_t size, off_t offset);
+off_t page_cache_write (struct inode *, const void *, off_t size,
+		off_t offset);
+bool page_cache_clean (struct page *page);
+void page_cache_release (struct inode *, bool discard);
+void page_cache_print_stats (void);
 #endif
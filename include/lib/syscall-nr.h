@@ -36,6 +36,11 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Extra for Project 3 */
+	SYS_MADVISE,                /* Advise on the use of a memory range. */
+	SYS_MSYNC,                  /* Write back a mapped range to its file. */
+	SYS_SHM_CREATE,             /* Create an anonymous shared memory segment. */
 };
 
 #endif /* lib/syscall-nr.h */
@@ -13,6 +13,21 @@ typedef int pid_t;
 typedef int off_t;
 #define MAP_FAILED ((void *) NULL)
 
+/* Flag for mmap(), or'd into WRITABLE. */
+#define MAP_SHARED 2            /* Share pages with other shared mappings. */
+
+/* Advice for madvise(). */
+#define MADV_NORMAL 0           /* No advice. */
+#define MADV_RANDOM 1           /* Random access: no readahead. */
+#define MADV_SEQUENTIAL 2       /* Sequential access: read ahead, reclaim behind. */
+#define MADV_WILLNEED 3         /* Read the pages in now. */
+#define MADV_DONTNEED 4         /* Drop the pages now. */
+#define MADV_FREE 8             /* Drop the pages now, anonymous memory only. */
+
+/* Flags for msync(). */
+#define MS_ASYNC 1              /* Start the writes and return. */
+#define MS_SYNC 4               /* Return once the writes are done. */
+
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
@@ -41,6 +56,9 @@ int dup2(int oldfd, int newfd);
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
+int madvise (void *addr, size_t length, int advice);
+int msync (void *addr, size_t length, int flags);
+int shm_create (size_t size);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -78,4 +96,32 @@ get_fs_disk_write_cnt (void) {
 	return write_cnt;
 }
 
+static inline long long
+get_swap_disk_read_cnt (void) {
+	long long read_cnt;
+	asm volatile ("movq $1, %rdx");
+	asm volatile ("movq $1, %rcx");
+	asm volatile ("int $0x43");
+	asm volatile ("\t movq %%rax, %0": "=r" (read_cnt));
+	return read_cnt;
+}
+
+static inline long long
+get_swap_disk_write_cnt (void) {
+	long long write_cnt;
+	asm volatile ("movq $1, %rdx");
+	asm volatile ("movq $1, %rcx");
+	asm volatile ("int $0x44");
+	asm volatile ("\t movq %%rax, %0": "=r" (write_cnt));
+	return write_cnt;
+}
+
+static inline long long
+get_page_fault_cnt (void) {
+	long long fault_cnt;
+	asm volatile ("int $0x45");
+	asm volatile ("\t movq %%rax, %0": "=r" (fault_cnt));
+	return fault_cnt;
+}
+
 #endif /* lib/user/syscall.h */
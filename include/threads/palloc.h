@@ -20,4 +20,11 @@ void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
 
+/* Project 3 */
+size_t palloc_user_page_cnt (void);
+size_t palloc_user_free_cnt (void);
+size_t palloc_user_page_idx (void *);
+void *palloc_get_aligned (enum palloc_flags, size_t page_cnt, size_t align_cnt);
+/* Project 3 */
+
 #endif /* threads/palloc.h */
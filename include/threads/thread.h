@@ -136,7 +136,9 @@ struct thread {
 	struct supplemental_page_table spt;
 	/* Project 3 */
 	uintptr_t ursp;
-	uintptr_t stack_bottom;
+	long long vm_faults;				/* Page faults handled. */
+	long long vm_major_faults;			/* Those that read from disk. */
+	struct anon_readahead swap_ra;		/* Owned by vm/anon.c. */
 	/* Project 3 */
 #endif
 
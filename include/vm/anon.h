@@ -8,7 +8,25 @@ struct anon_page {
     size_t idx;
 };
 
+/* Swap-in readahead state of a process. */
+struct anon_readahead {
+    void *last_va;      /* Page of the last swap-in fault */
+    void *start;        /* First page read ahead by that fault */
+    size_t cnt;         /* Number of pages read ahead by that fault */
+    size_t window;      /* Number of pages to read ahead on the next one */
+};
+
+/* Maximum number of pages swapped out by one anon_swap_out_multiple. */
+#define ANON_SWAP_BATCH 8
+
+/* Maximum number of pages read ahead on a swap-in fault. */
+#define ANON_READAHEAD_MAX 16
+
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+bool anon_swap_out_multiple (struct page *pages[], bool evicted[], size_t cnt);
+bool anon_writeback (struct page *page);
+bool anon_is_clean (struct page *page);
+void anon_print_stats (void);
 
 #endif
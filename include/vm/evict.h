@@ -0,0 +1,25 @@
+#ifndef VM_EVICT_H
+#define VM_EVICT_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct frame;
+
+/* A page replacement policy.
+ * Like page_operations, this is a table of "method"s, and the policy in use
+ * is picked by name from the kernel command line (-evict=POLICY). */
+struct evict_policy {
+	const char *name;
+	/* Pick the frame to evict. Return NULL if nothing can be evicted. */
+	struct frame *(*get_victim) (void);
+};
+
+/* -evict=POLICY: name of the replacement policy. */
+extern const char *evict_policy_name;
+
+void vm_evict_init (void);
+struct frame *vm_evict_get_victim (void);
+size_t vm_evict_scan_ahead (struct frame *frames[], size_t cnt);
+void vm_evict_print_stats (void);
+
+#endif /* vm/evict.h */
@@ -4,10 +4,20 @@
 #include "vm/vm.h"
 
 struct page;
+struct supplemental_page_table;
+struct vma;
 enum vm_type;
 
+/* Flag of mmap, or'd into WRITABLE, as in lib/user/syscall.h. */
+#define MAP_SHARED 2		/* Share frames with other shared mappings */
+
+/* Flags of msync, as in lib/user/syscall.h. */
+#define MS_ASYNC 1			/* Leave the writes to the writeback daemon */
+#define MS_SYNC 4			/* Write back before returning */
+
 struct file_page {
 	struct file * file;
+	struct vma *vma;		/* Area holding the page */
 	off_t ofs;
 	uint32_t page_read_bytes;
 	uint32_t page_zero_bytes;
@@ -15,6 +25,12 @@ struct file_page {
 
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
+bool file_backed_writeback (struct page *page);
+bool file_backed_writable (struct page *page);
+bool file_backed_mark_dirty (struct supplemental_page_table *spt, void *upage);
+bool file_backed_flush (struct supplemental_page_table *spt, void *start,
+		void *end);
+bool do_msync (void *addr, size_t length, int flags);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
@@ -0,0 +1,16 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+#include <stddef.h>
+
+/* Swap slot allocator. A slot holds one page, and is shared by every page
+ * holding a reference to it. Slots come out of swap_alloc with no
+ * reference, and go back to the free extents when the last reference is
+ * dropped. Errors are reported as BITMAP_ERROR. */
+void swap_init (size_t slot_cnt);
+size_t swap_alloc (size_t cnt, size_t hint);
+void swap_ref (size_t idx);
+void swap_unref (size_t idx);
+int swap_ref_cnt (size_t idx);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */
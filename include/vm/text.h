@@ -0,0 +1,21 @@
+#ifndef VM_TEXT_H
+#define VM_TEXT_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct inode;
+
+/* Cache of the resident pages of read-only executable segments and of
+ * shared mappings, keyed by inode and file offset, so every process
+ * running a binary or mapping a file shared maps the same frames. The
+ * frame lock must be held for all of these. */
+void vm_text_init (void);
+void *vm_text_lookup (struct inode *inode, off_t ofs, size_t *read_bytes,
+		bool shared);
+void vm_text_insert (struct inode *inode, off_t ofs, size_t read_bytes,
+		bool shared, void *kva);
+void vm_text_remove (void *kva);
+void vm_text_print_stats (void);
+
+#endif /* vm/text.h */
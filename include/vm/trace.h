@@ -0,0 +1,30 @@
+#ifndef VM_TRACE_H
+#define VM_TRACE_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Traced VM events. A fault is classed by the path that handled it. */
+enum vm_trace_event {
+	TRACE_FAULT_STACK,		/* Stack growth */
+	TRACE_FAULT_LAZY,		/* First touch of a page, loaded or zeroed */
+	TRACE_FAULT_ZERO,		/* Read of a zero-fill page, zero page mapped */
+	TRACE_FAULT_HUGE,		/* First touch, mapped with a large page */
+	TRACE_FAULT_TEXT,		/* Code page mapped from the text cache */
+	TRACE_FAULT_SWAP,		/* Anonymous page read back from swap */
+	TRACE_FAULT_FILE,		/* File-backed page read back */
+	TRACE_FAULT_COW,		/* Write to a page shared copy-on-write */
+	TRACE_FAULT_WAIT,		/* Page found resident after waiting on it */
+	TRACE_EVICT,			/* vm_evict_frame */
+	TRACE_SWAP_IN,			/* Disk read of a swap-in, readahead included */
+	TRACE_SWAP_OUT,			/* Disk write of a batch of swapped out pages */
+	TRACE_EVENT_CNT
+};
+
+/* -vm-trace: record the events and print their latency histograms. */
+extern bool vm_trace_enabled;
+
+uint64_t vm_trace_begin (void);
+void vm_trace_end (enum vm_trace_event event, uint64_t start, const void *va);
+void vm_trace_print_stats (void);
+
+#endif /* vm/trace.h */
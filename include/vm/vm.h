@@ -4,6 +4,7 @@
 #include "threads/palloc.h"
 /* Project 3 */
 #include <hash.h>
+#include "threads/synch.h"
 /* Project 3 */
 
 enum vm_type {
@@ -36,6 +37,7 @@ enum vm_type {
 
 struct page_operations;
 struct thread;
+struct vma;
 
 #define VM_TYPE(type) ((type) & 7)
 
@@ -52,8 +54,8 @@ struct page {
 	/* Project 3 */
 	struct hash_elem spt_elem;
 	bool writable;
-	int64_t mmap_id;
 	uint64_t *pml4;			/* For COW */
+	bool busy;				/* Frame under I/O, see vm_frame_set_busy */
 	/* Project 3 */
 
 	/* Per-type data are binded into the union.
@@ -73,11 +75,28 @@ struct frame {
 	void *kva;
 	struct page *page;
 	/* Project 3 */
-	struct list_elem ft_elem;
-	int cpy_cnt;
+	struct list_elem rmap_elem;		/* Element for phys_frame's rmap */
 	/* Project 3 */
 };
 
+/* Project 3 */
+/* Descriptor of a physical user page. There is exactly one per user pool
+ * page, indexed by its kva, and it is shared by every frame that maps
+ * that kva after fork. */
+struct phys_frame {
+	int cpy_cnt;			/* Number of mappers besides the first one */
+	struct list rmap;		/* Frames (and so (pml4, va)) mapping this kva */
+	int pin_cnt;			/* Not evicted while positive, e.g. being filled */
+
+	/* Replacement state, see vm/evict.c */
+	bool referenced;		/* Referenced since the hand last passed */
+	bool dirty;				/* Needs a write before it can be reused */
+	int64_t last_used;		/* Tick the frame was last seen referenced */
+
+	struct text_page *text;	/* Entry in the text cache, see vm/text.c */
+};
+/* Project 3 */
+
 /* The function table for page operations.
  * This is one way of implementing "interface" in C.
  * Put the table of "method" into the struct's member, and
@@ -100,20 +119,11 @@ struct page_operations {
 struct supplemental_page_table {
 	/* Project 3 */
 	struct hash spt_hash_table;
+	struct vma *vmas;		/* Areas, see vm/vma.c */
+	struct lock lock;		/* Protects the table, its areas and its pages */
 	/* Project 3 */
 };
 
-/* Project 3 */
-/* Structure for lazy load. It contains necessary informations for loading of binary.*/
-struct load_info {
-	struct file *file;
-	off_t ofs;
-	uint32_t page_read_bytes;
-	uint32_t page_zero_bytes;
-	int64_t mmap_id;
-};
-/* Project 3 */
-
 #include "threads/thread.h"
 void supplemental_page_table_init (struct supplemental_page_table *spt);
 bool supplemental_page_table_copy (struct supplemental_page_table *dst,
@@ -121,10 +131,12 @@ bool supplemental_page_table_copy (struct supplemental_page_table *dst,
 void supplemental_page_table_kill (struct supplemental_page_table *spt);
 struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
+struct page *spt_get_page (struct supplemental_page_table *spt, void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
 void vm_init (void);
+void vm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -137,8 +149,56 @@ bool vm_claim_page (void *va);
 enum vm_type page_get_type (struct page *page);
 
 /* Project 3 */
+/* Protects phys_frames, every rmap and the busy bits. Held briefly, never
+ * across I/O. */
+extern struct lock frame_lock;
+/* Serializes eviction and writeback, which do I/O without frame_lock. */
+extern struct lock evict_lock;
+/* -fault-around=N: pages loaded together on the first touch of an
+ * executable segment. 0 or 1 disables fault-around. */
+extern size_t fault_around_pages;
+/* -stack-chunk=N: pages the stack grows by on a fault below it. */
+extern size_t stack_chunk_pages;
+/* The stack may grow down to USER_STACK - STACK_LIMIT. Nothing else is
+ * mapped there. */
+#define STACK_LIMIT (1 << 20)
+/* -no-huge clears: map aligned 2 MiB runs of data and mmaps with large
+ * pages. */
+extern bool huge_pages;
+/* -vm-stats: print the VM statistics of each process as it exits. */
+extern bool vm_stats_on_exit;
+
+/* VM statistics of a process, see vm_thread_stats. */
+struct vm_stats {
+	size_t resident;		/* Pages in a frame */
+	size_t shared;			/* Of those, sharing it with other pages */
+	size_t file;			/* Of those, file-backed */
+	size_t swapped;			/* Anonymous pages out in swap */
+	long long faults;		/* Page faults handled */
+	long long major_faults;	/* Of those, waiting on a disk read */
+};
+struct thread;
+void vm_thread_stats (struct thread *t, struct vm_stats *stats);
+void vm_print_thread_stats (struct thread *t);
+
 uint64_t spt_hash_func (const struct hash_elem *e, void *aux UNUSED);
 bool spt_hash_less_func (const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED);
+struct phys_frame *vm_phys_frame (void *kva);
+struct phys_frame *vm_phys_frame_at (size_t idx);
+void vm_free_frame (struct frame *frame);
+struct frame *vm_get_frame (void);
+struct frame *vm_alloc_frame (void);
+void vm_unpin_frame (void *kva);
+bool vm_huge_split (struct supplemental_page_table *spt, void *start, void *end);
+bool vm_madvise (void *addr, size_t length, int advice);
+struct frame *vm_pin_page_frame (struct page *page);
+void vm_frame_set_busy (struct frame *frame, bool busy);
+bool vm_page_set_busy (struct page *page, bool busy);
+size_t vm_reclaim_frames (size_t cnt);
+bool vm_frame_test_and_clear_accessed (struct frame *frame);
+bool vm_frame_is_dirty (struct frame *frame);
+bool vm_frame_test_and_clear_dirty (struct frame *frame);
+bool vm_frame_unmap_all (struct frame *frame);
 bool vm_cow_frame_connect (struct page * dst_page, struct page * src_page);
 bool vm_copy_on_write(struct page * page);
 void vm_dec_cpy_cnt(void * kva, int cnt);
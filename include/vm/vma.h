@@ -0,0 +1,57 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+#include "vm/vm.h"
+
+struct file;
+struct bitmap;
+
+/* Advice of madvise, as in lib/user/syscall.h. An area keeps the last of
+ * NORMAL, RANDOM and SEQUENTIAL, the others act right away. */
+#define MADV_NORMAL 0		/* No advice */
+#define MADV_RANDOM 1		/* No readahead */
+#define MADV_SEQUENTIAL 2	/* Read ahead, reclaim behind */
+#define MADV_WILLNEED 3		/* Read the pages in now */
+#define MADV_DONTNEED 4		/* Drop the pages now */
+#define MADV_FREE 8			/* Drop the pages now, anonymous areas only */
+
+/* A virtual memory area: a run of pages of a process backed the same
+ * way. The struct pages of an area are only created when they are first
+ * touched, see spt_get_page. Areas never overlap, and are kept in an AVL
+ * tree sorted by address. */
+struct vma {
+	void *start;			/* First page */
+	void *end;				/* One past the last page */
+	enum vm_type type;		/* VM_ANON or VM_FILE */
+	bool writable;
+	bool exec;				/* Executable segment, not an mmap */
+	bool shared;			/* MAP_SHARED mmap, see vm/text.c */
+	struct file *file;		/* Reopened for the area, or NULL */
+	off_t ofs;				/* Offset of START in FILE */
+	size_t read_bytes;		/* Bytes read from FILE, the rest is zeroed */
+	int advice;				/* MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL */
+	struct bitmap *dirty;	/* Dirty set of a writable mmap, or NULL */
+
+	struct vma *left, *right;
+	int height;
+};
+
+struct vma *vma_map (struct supplemental_page_table *spt, void *start,
+		size_t length, enum vm_type type, bool writable,
+		struct file *file, off_t ofs, size_t read_bytes);
+void vma_unmap (struct supplemental_page_table *spt, struct vma *vma);
+struct vma *vma_find (struct supplemental_page_table *spt, const void *va);
+struct vma *vma_first (struct supplemental_page_table *spt, const void *va);
+bool vma_overlaps (struct supplemental_page_table *spt, const void *start,
+		const void *end);
+bool vma_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src);
+bool vma_grow_down (struct supplemental_page_table *spt, struct vma *vma,
+		void *start);
+void vma_unmap_all (struct supplemental_page_table *spt);
+off_t vma_page_ofs (struct vma *vma, const void *upage);
+size_t vma_page_read_bytes (struct vma *vma, const void *upage);
+
+#endif /* vm/vma.h */
@@ -0,0 +1,20 @@
+#ifndef VM_WRITEBACK_H
+#define VM_WRITEBACK_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct supplemental_page_table;
+
+/* -wb-low=N, -wb-high=N: free frame watermarks of the writeback daemon.
+ * A low watermark of 0 disables the daemon. */
+extern size_t writeback_low_pages;
+extern size_t writeback_high_pages;
+
+void vm_writeback_init (void);
+void vm_writeback_kick (void);
+bool vm_writeback_flush_async (struct supplemental_page_table *spt,
+		void *start, void *end);
+void vm_writeback_flush_cancel (struct supplemental_page_table *spt);
+void vm_writeback_print_stats (void);
+
+#endif /* vm/writeback.h */
@@ -0,0 +1,26 @@
+/* Child process of mmap-shared.
+   Maps "shared.txt" with MAP_SHARED, checks that it sees the
+   parent's writes, and overwrites them. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+
+void
+test_main (void)
+{
+  char *map = (char *) 0x20000000;
+  size_t i;
+  int fd;
+
+  CHECK ((fd = open ("shared.txt")) > 1, "open \"shared.txt\"");
+  CHECK (mmap (map, PAGE_SIZE, 1 | MAP_SHARED, fd, 0) != MAP_FAILED,
+         "mmap \"shared.txt\" shared");
+  for (i = 0; i < PAGE_SIZE; i++)
+    if (map[i] != 'P')
+      fail ("byte %zu is %d, the parent's write is not seen", i, map[i]);
+  memset (map, 'C', PAGE_SIZE);
+}
@@ -0,0 +1,43 @@
+/* Touches one byte in a 2 MiB aligned run of a large BSS array and
+   checks that the whole run is mapped at once, to physically
+   contiguous frames starting on a 2 MiB boundary: a single large
+   page.  Then checks that the run reads back as zeros except for the
+   byte written. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define LARGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* Room for an aligned run well away from the other data, so that
+   nothing else touches it first. */
+static char bss[3 * LARGE_PAGE_SIZE];
+
+void
+test_main (void)
+{
+  char *run = (char *) (((uintptr_t) bss + LARGE_PAGE_SIZE / 2
+                         + LARGE_PAGE_SIZE - 1)
+                        & ~(uintptr_t) (LARGE_PAGE_SIZE - 1));
+  uintptr_t base;
+  size_t ofs;
+
+  CHECK (get_phys_addr (run) == 0, "run is not loaded yet");
+  run[5 * PAGE_SIZE] = 'x';
+
+  base = (uintptr_t) get_phys_addr (run);
+  CHECK (base != 0 && base % LARGE_PAGE_SIZE == 0,
+         "run starts on an aligned frame");
+  for (ofs = 0; ofs < LARGE_PAGE_SIZE; ofs += PAGE_SIZE)
+    if ((uintptr_t) get_phys_addr (run + ofs) != base + ofs)
+      fail ("page at offset %zu is not in the large page", ofs);
+  msg ("whole run is mapped contiguously");
+
+  for (ofs = 0; ofs < LARGE_PAGE_SIZE; ofs++)
+    if (run[ofs] != (ofs == 5 * PAGE_SIZE ? 'x' : 0))
+      fail ("byte %zu has wrong contents", ofs);
+  msg ("contents are correct");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(huge-bss) begin
+(huge-bss) run is not loaded yet
+(huge-bss) run starts on an aligned frame
+(huge-bss) whole run is mapped contiguously
+(huge-bss) contents are correct
+(huge-bss) end
+EOF
+pass;
@@ -0,0 +1,49 @@
+/* Gives each kind of advice to a mapping of "sample.txt" and to a
+   BSS buffer, and checks that dropped pages come back from the file
+   or as zeros, and that invalid advice is refused. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+
+static char bss[4 * PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+void
+test_main (void)
+{
+  char *map = (char *) 0x10000000;
+  int fd;
+
+  CHECK ((fd = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (mmap (map, PAGE_SIZE, 1, fd, 0) != MAP_FAILED,
+         "mmap \"sample.txt\"");
+
+  CHECK (madvise (map, PAGE_SIZE, MADV_SEQUENTIAL) == 0, "advise sequential");
+  CHECK (madvise (map, PAGE_SIZE, MADV_RANDOM) == 0, "advise random");
+  CHECK (madvise (map, PAGE_SIZE, MADV_WILLNEED) == 0, "advise willneed");
+  if (get_phys_addr (map) == NULL)
+    fail ("page not resident after willneed");
+  if (memcmp (map, sample, strlen (sample)))
+    fail ("mapping differs from \"sample.txt\"");
+
+  map[0] = 'X';
+  CHECK (madvise (map, PAGE_SIZE, MADV_DONTNEED) == 0, "advise dontneed");
+  if (map[0] != 'X')
+    fail ("write lost after dontneed on the mapping");
+  CHECK (madvise (map, PAGE_SIZE, MADV_FREE) == -1,
+         "try to free a file mapping");
+
+  memset (bss, 0x5a, sizeof bss);
+  CHECK (madvise (bss, sizeof bss, MADV_FREE) == 0, "advise free");
+  if (bss[0] != 0 || bss[sizeof bss - 1] != 0)
+    fail ("bss not zero after free");
+
+  CHECK (madvise (map, PAGE_SIZE, 5) == -1, "try bad advice");
+  CHECK (madvise (map + 1, PAGE_SIZE, MADV_NORMAL) == -1,
+         "try misaligned address");
+  munmap (map);
+}
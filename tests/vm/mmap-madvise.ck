@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-madvise) begin
+(mmap-madvise) open "sample.txt"
+(mmap-madvise) mmap "sample.txt"
+(mmap-madvise) advise sequential
+(mmap-madvise) advise random
+(mmap-madvise) advise willneed
+(mmap-madvise) advise dontneed
+(mmap-madvise) try to free a file mapping
+(mmap-madvise) advise free
+(mmap-madvise) try bad advice
+(mmap-madvise) try misaligned address
+(mmap-madvise) end
+EOF
+pass;
@@ -0,0 +1,83 @@
+/* Writes to a mapping of a file spanning several pages, and
+   checks that msync writes the data back while the file stays
+   mapped, both with MS_SYNC and MS_ASYNC.  With MS_ASYNC, the file
+   is polled through a second descriptor until the writeback daemon
+   has written it, before the mapping goes away.  Also checks that
+   msync refuses unmapped ranges and bad flags. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define FILE_SIZE (3 * PAGE_SIZE + 100)
+
+/* Times the file is read while waiting for the writeback daemon. */
+#define ASYNC_TRIES 50000
+
+static char buf[FILE_SIZE];
+
+static void
+check_contents (int fd, char c, const char *what)
+{
+  size_t i;
+
+  seek (fd, 0);
+  if (read (fd, buf, FILE_SIZE) != FILE_SIZE)
+    fail ("read \"msync.txt\" after %s", what);
+  for (i = 0; i < FILE_SIZE; i++)
+    if (buf[i] != c)
+      fail ("byte %zu of \"msync.txt\" is %d after %s", i, buf[i], what);
+}
+
+/* Returns true if every byte of the file open as FD is C. */
+static bool
+has_contents (int fd, char c)
+{
+  size_t i;
+
+  seek (fd, 0);
+  if (read (fd, buf, FILE_SIZE) != FILE_SIZE)
+    return false;
+  for (i = 0; i < FILE_SIZE; i++)
+    if (buf[i] != c)
+      return false;
+  return true;
+}
+
+void
+test_main (void)
+{
+  char *map = (char *) 0x10000000;
+  int fd, fd2, i;
+
+  CHECK (create ("msync.txt", FILE_SIZE), "create \"msync.txt\"");
+  CHECK ((fd = open ("msync.txt")) > 1, "open \"msync.txt\"");
+  CHECK (mmap (map, FILE_SIZE, 1, fd, 0) != MAP_FAILED, "mmap \"msync.txt\"");
+
+  memset (map, 'a', FILE_SIZE);
+  CHECK (msync (map, FILE_SIZE, MS_SYNC) == 0, "msync with MS_SYNC");
+  check_contents (fd, 'a', "MS_SYNC");
+
+  memset (map, 'b', FILE_SIZE);
+  CHECK (msync (map, FILE_SIZE, MS_ASYNC) == 0, "msync with MS_ASYNC");
+  CHECK ((fd2 = open ("msync.txt")) > 1, "open \"msync.txt\" again");
+  for (i = 0; i < ASYNC_TRIES && !has_contents (fd2, 'b'); i++)
+    continue;
+  if (i == ASYNC_TRIES)
+    fail ("MS_ASYNC data did not reach \"msync.txt\" while mapped");
+  msg ("MS_ASYNC data reached the file while mapped");
+  close (fd2);
+  munmap (map);
+  check_contents (fd, 'b', "MS_ASYNC and munmap");
+
+  CHECK (msync (map, PAGE_SIZE, MS_SYNC) == -1, "try to msync unmapped range");
+  CHECK (mmap (map, FILE_SIZE, 1, fd, 0) != MAP_FAILED,
+         "mmap \"msync.txt\" again");
+  CHECK (msync (map, PAGE_SIZE, MS_SYNC | MS_ASYNC) == -1,
+         "try to msync with bad flags");
+  CHECK (msync (map, 5 * PAGE_SIZE, MS_SYNC) == -1,
+         "try to msync past the mapping");
+  close (fd);
+}
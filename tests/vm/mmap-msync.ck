@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-msync) begin
+(mmap-msync) create "msync.txt"
+(mmap-msync) open "msync.txt"
+(mmap-msync) mmap "msync.txt"
+(mmap-msync) msync with MS_SYNC
+(mmap-msync) msync with MS_ASYNC
+(mmap-msync) open "msync.txt" again
+(mmap-msync) MS_ASYNC data reached the file while mapped
+(mmap-msync) try to msync unmapped range
+(mmap-msync) mmap "msync.txt" again
+(mmap-msync) try to msync with bad flags
+(mmap-msync) try to msync past the mapping
+(mmap-msync) end
+EOF
+pass;
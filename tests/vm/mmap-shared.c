@@ -0,0 +1,38 @@
+/* Maps a file with MAP_SHARED and runs child-shared, which maps
+   the same file the same way and writes to it.  The parent must
+   see the child's writes in its own mapping, without unmapping
+   or reading the file again. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+
+void
+test_main (void)
+{
+  char *map = (char *) 0x10000000;
+  pid_t child;
+  size_t i;
+  int fd;
+
+  CHECK (create ("shared.txt", PAGE_SIZE), "create \"shared.txt\"");
+  CHECK ((fd = open ("shared.txt")) > 1, "open \"shared.txt\"");
+  CHECK (mmap (map, PAGE_SIZE, 1 | MAP_SHARED, fd, 0) != MAP_FAILED,
+         "mmap \"shared.txt\" shared");
+  memset (map, 'P', PAGE_SIZE);
+
+  quiet = true;
+  child = fork ("child-shared");
+  if (child == 0)
+    CHECK (exec ("child-shared") != -1, "exec \"child-shared\"");
+  CHECK (wait (child) == 0, "wait for child (should return 0)");
+  quiet = false;
+
+  for (i = 0; i < PAGE_SIZE; i++)
+    if (map[i] != 'C')
+      fail ("byte %zu is %d, the child's write is not seen", i, map[i]);
+  msg ("parent sees the child's writes");
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-shared) begin
+(mmap-shared) create "shared.txt"
+(mmap-shared) open "shared.txt"
+(mmap-shared) mmap "shared.txt" shared
+(child-shared) begin
+(child-shared) open "shared.txt"
+(child-shared) mmap "shared.txt" shared
+(child-shared) end
+(mmap-shared) parent sees the child's writes
+(mmap-shared) end
+EOF
+pass;
@@ -0,0 +1,56 @@
+/* Creates an anonymous shared memory segment, maps it, and forks a
+   child that writes to the inherited mapping.  The parent must see
+   the writes, and a second mapping of the segment must show the
+   same pages as the first. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define SHM_SIZE (2 * PAGE_SIZE)
+
+static void
+check_bytes (const char *map, char c, const char *what)
+{
+  size_t i;
+
+  for (i = 0; i < SHM_SIZE; i++)
+    if (map[i] != c)
+      fail ("byte %zu is %d, %s", i, map[i], what);
+}
+
+void
+test_main (void)
+{
+  char *map = (char *) 0x10000000;
+  char *map2 = (char *) 0x20000000;
+  pid_t child;
+  int fd;
+
+  CHECK ((fd = shm_create (SHM_SIZE)) > 1, "shm_create");
+  CHECK (mmap (map, SHM_SIZE, 1 | MAP_SHARED, fd, 0) != MAP_FAILED,
+         "mmap segment");
+  check_bytes (map, 0, "the segment is not zeroed");
+  memset (map, 'p', SHM_SIZE);
+
+  child = fork ("child");
+  if (child == 0)
+    {
+      check_bytes (map, 'p', "the child does not see the parent's write");
+      memset (map, 'c', SHM_SIZE);
+      exit (0);
+    }
+  CHECK (wait (child) == 0, "wait for child");
+  check_bytes (map, 'c', "the parent does not see the child's write");
+
+  CHECK (mmap (map2, SHM_SIZE, 1 | MAP_SHARED, fd, 0) != MAP_FAILED,
+         "mmap segment again");
+  check_bytes (map2, 'c', "the second mapping differs");
+  memset (map2, 'x', SHM_SIZE);
+  check_bytes (map, 'x', "the first mapping misses the second's write");
+  munmap (map2);
+  munmap (map);
+  close (fd);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-shm) begin
+(mmap-shm) shm_create
+(mmap-shm) mmap segment
+(mmap-shm) wait for child
+(mmap-shm) mmap segment again
+(mmap-shm) end
+EOF
+pass;
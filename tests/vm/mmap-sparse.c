@@ -0,0 +1,46 @@
+/* Maps most of "large.txt" and a 32 MB BSS array, touches only a few
+   pages of each, and checks their contents.  Also verifies that a
+   mapping overlapping the tail of another one, rather than its first
+   page, is disallowed. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define BSS_SIZE (32 * 1024 * 1024)
+
+static char bss[BSS_SIZE];
+
+void
+test_main (void)
+{
+  char *map = (char *) 0x10000000;
+  char buf[16];
+  size_t ofs;
+  int fd;
+
+  CHECK ((fd = open ("large.txt")) > 1, "open \"large.txt\"");
+  CHECK (mmap (map, 1024 * 1024, 0, fd, 0) != MAP_FAILED,
+         "mmap \"large.txt\"");
+  for (ofs = 0; ofs < 1024 * 1024; ofs += 256 * 1024)
+    {
+      seek (fd, ofs);
+      CHECK (read (fd, buf, sizeof buf) == (int) sizeof buf,
+             "read \"large.txt\" at %zu", ofs);
+      if (memcmp (map + ofs, buf, sizeof buf))
+        fail ("mapping differs from file at %zu", ofs);
+    }
+  CHECK (mmap (map + 512 * 1024, PAGE_SIZE, 0, fd, 0) == MAP_FAILED,
+         "try to mmap over the middle of the mapping");
+
+  for (ofs = 0; ofs < BSS_SIZE; ofs += 4 * 1024 * 1024)
+    {
+      if (bss[ofs] != 0)
+        fail ("bss byte %zu is not zero", ofs);
+      bss[ofs] = 1;
+    }
+  msg ("touched bss");
+  munmap (map);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-sparse) begin
+(mmap-sparse) open "large.txt"
+(mmap-sparse) mmap "large.txt"
+(mmap-sparse) read "large.txt" at 0
+(mmap-sparse) read "large.txt" at 262144
+(mmap-sparse) read "large.txt" at 524288
+(mmap-sparse) read "large.txt" at 786432
+(mmap-sparse) try to mmap over the middle of the mapping
+(mmap-sparse) touched bss
+(mmap-sparse) end
+EOF
+pass;
@@ -0,0 +1,36 @@
+/* Runs 16 child-linear processes at once, so that several processes
+   fault, evict and swap in parallel, and reports page faults and swap
+   disk I/O over the whole run.  page-parallel-stress.ck derives the
+   throughput from the run's timer ticks. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 16
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  long long faults, reads, writes;
+  int i;
+
+  faults = get_page_fault_cnt ();
+  reads = get_swap_disk_read_cnt ();
+  writes = get_swap_disk_write_cnt ();
+  for (i = 0; i < CHILD_CNT; i++) {
+    children[i] = fork ("child-linear");
+    if (children[i] == 0) {
+      if (exec ("child-linear") == -1)
+        fail ("failed to exec child-linear");
+    }
+  }
+  for (i = 0; i < CHILD_CNT; i++) {
+    CHECK (wait (children[i]) == 0x42, "wait for child %d", i);
+  }
+  msg ("%d children: %lld faults, %lld swap reads, %lld swap writes",
+       CHILD_CNT, get_page_fault_cnt () - faults,
+       get_swap_disk_read_cnt () - reads,
+       get_swap_disk_write_cnt () - writes);
+}
@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+my ($ticks) = map (/^Timer: (\d+) ticks$/ ? $1 : (), @output);
+@output = get_core_output ("run", @output);
+
+my (@expected) = ("(page-parallel-stress) begin");
+push (@expected, "(page-parallel-stress) wait for child $_") foreach 0...15;
+push (@expected, "(page-parallel-stress) end");
+for my $line (@expected) {
+    fail "Output missing '$line' message.\n"
+      if !grep ($line eq $_, @output);
+}
+fail "Output missing statistics.\n"
+  if !grep (/^\(page-parallel-stress\) 16 children: \d+ faults, \d+ swap reads, \d+ swap writes$/,
+	    @output);
+
+# Each child encrypts and decrypts 1 MB; the timer runs at 100 Hz.
+pass (sprintf ("%.2f MB/s", 16 * 2 / ($ticks / 100)))
+  if defined $ticks && $ticks > 0;
+pass;
@@ -0,0 +1,72 @@
+/* Page replacement benchmark.  Runs the swap-iter and page-shuffle
+   workloads against each other: a 128 kB buffer is shuffled while a
+   16 MB chunk is swept sparsely, so a good policy keeps the shuffled
+   buffer resident.  Reports page faults and swap disk I/O of each
+   phase.  Built once per policy, see Make.tests. */
+
+#include <stdbool.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/cksum.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define ONE_MB (1 << 20)
+#define HOT_SIZE (128 * 1024)
+#define COLD_SIZE (16 * ONE_MB)
+#define COLD_PAGES (COLD_SIZE / PAGE_SIZE)
+#define SHUFFLES 10
+
+static char hot[HOT_SIZE];
+static char cold[COLD_SIZE];
+
+static long long faults, reads, writes;
+
+static void
+stats_begin (void)
+{
+  faults = get_page_fault_cnt ();
+  reads = get_swap_disk_read_cnt ();
+  writes = get_swap_disk_write_cnt ();
+}
+
+static void
+stats_end (const char *phase)
+{
+  msg ("%s: %lld faults, %lld swap reads, %lld swap writes", phase,
+       get_page_fault_cnt () - faults,
+       get_swap_disk_read_cnt () - reads,
+       get_swap_disk_write_cnt () - writes);
+}
+
+void
+test_main (void)
+{
+  size_t i, j;
+
+  /* Fill the cold chunk sparsely, then check it back, as swap-iter. */
+  stats_begin ();
+  for (i = 0; i < COLD_PAGES; i++)
+    cold[i * PAGE_SIZE] = (char) i;
+  for (i = 0; i < COLD_PAGES; i++)
+    if (cold[i * PAGE_SIZE] != (char) i)
+      fail ("cold page %zu is inconsistent", i);
+  stats_end ("iter");
+
+  /* Shuffle the hot buffer as page-shuffle, sweeping a slice of the
+     cold chunk between shuffles. */
+  stats_begin ();
+  for (i = 0; i < sizeof hot; i++)
+    hot[i] = i * 257;
+  msg ("init: cksum=%lu", cksum (hot, sizeof hot));
+  for (i = 0; i < SHUFFLES; i++)
+    {
+      shuffle (hot, sizeof hot, 1);
+      msg ("shuffle %zu: cksum=%lu", i, cksum (hot, sizeof hot));
+      for (j = i; j < COLD_PAGES; j += SHUFFLES)
+        if (cold[j * PAGE_SIZE] != (char) j)
+          fail ("cold page %zu is inconsistent", j);
+    }
+  stats_end ("shuffle");
+}
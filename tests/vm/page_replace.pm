@@ -0,0 +1,39 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+sub check_page_replace {
+    my ($proc_name) = @_;
+    our ($test);
+    my (@output) = read_text_file ("$test.output");
+
+    # Same values as page-shuffle.
+    my ($init) = 3115322833;
+    my (@shuffle) = (2274652418, 2281360714, 3504443700, 2850516818,
+		     2406916757, 3377643430, 658047850, 493716582,
+		     3359519593, 143675990);
+
+    common_checks ("run", @output);
+    @output = get_core_output ("run", @output);
+
+    my (@expected) = ("($proc_name) begin",
+		      "($proc_name) init: cksum=$init");
+    push (@expected, "($proc_name) shuffle $_: cksum=$shuffle[$_]")
+      foreach 0...$#shuffle;
+    push (@expected, "($proc_name) end");
+    for my $line (@expected) {
+	fail "Output missing '$line' message.\n"
+	  if !grep ($line eq $_, @output);
+    }
+
+    # Fault and I/O counts depend on the policy, only check they are there.
+    for my $phase ('iter', 'shuffle') {
+	fail "Output missing '$phase' statistics.\n"
+	  if !grep (/^\($proc_name\) $phase: \d+ faults, \d+ swap reads, \d+ swap writes$/,
+		    @output);
+    }
+    pass;
+}
+
+1;
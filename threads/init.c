@@ -31,9 +31,15 @@
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/evict.h"
+#include "vm/writeback.h"
+#include "vm/swap.h"
+#include "vm/text.h"
+#include "vm/trace.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "filesys/buffer_cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -226,6 +232,24 @@ parse_options (char **argv) {
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-evict"))
+			evict_policy_name = value;
+		else if (!strcmp (name, "-wb-low"))
+			writeback_low_pages = atoi (value);
+		else if (!strcmp (name, "-wb-high"))
+			writeback_high_pages = atoi (value);
+		else if (!strcmp (name, "-fault-around"))
+			fault_around_pages = atoi (value);
+		else if (!strcmp (name, "-stack-chunk"))
+			stack_chunk_pages = atoi (value);
+		else if (!strcmp (name, "-no-huge"))
+			huge_pages = false;
+		else if (!strcmp (name, "-vm-stats"))
+			vm_stats_on_exit = true;
+		else if (!strcmp (name, "-vm-trace"))
+			vm_trace_enabled = true;
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -328,6 +352,16 @@ usage (void) {
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -evict=POLICY      Use POLICY (clock, wsclock) for page replacement.\n"
+			"  -wb-low=N          Keep N free user pages by background writeback.\n"
+			"  -wb-high=N         Let background writeback stop at N free pages.\n"
+			"  -fault-around=N    Load N pages around the first fault on code.\n"
+			"  -stack-chunk=N     Grow the stack by N pages at a time (1-16).\n"
+			"  -no-huge           Do not map data and mmaps with 2 MiB pages.\n"
+			"  -vm-stats          Print VM statistics of each process at exit.\n"
+			"  -vm-trace          Trace VM latencies, print histograms at shutdown.\n"
 #endif
 			);
 	power_off ();
@@ -356,10 +390,23 @@ print_stats (void) {
 	thread_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
+	buffer_cache_print_stats ();
 #endif
 	console_print_stats ();
 	kbd_print_stats ();
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	vm_print_stats ();
+	vm_evict_print_stats ();
+#ifdef EFILESYS
+	page_cache_print_stats ();
+#endif
+	vm_writeback_print_stats ();
+	swap_print_stats ();
+	anon_print_stats ();
+	vm_text_print_stats ();
+	vm_trace_print_stats ();
+#endif
 }
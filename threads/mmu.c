@@ -13,6 +13,10 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
+		/* A large page has no page table. pml4_split_large_page must
+		 * turn it into one first. */
+		if ((uint64_t) pte & PTE_PS)
+			return NULL;
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
 				uint64_t *new_page = palloc_get_page (PAL_ZERO);
@@ -88,6 +92,29 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the address of the page directory entry for virtual
+ * address VA in PML4, creating the upper levels if CREATE is
+ * true. Returns a null pointer if they are missing, or cannot
+ * be allocated. */
+static uint64_t *
+pde_walk (uint64_t *pml4, const uint64_t va, bool create) {
+	uint64_t *pml4e = &pml4[PML4 (va)];
+	if (!(*pml4e & PTE_P)) {
+		uint64_t *new_page = create ? palloc_get_page (PAL_ZERO) : NULL;
+		if (new_page == NULL)
+			return NULL;
+		*pml4e = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	uint64_t *pdpe = (uint64_t *) ptov (PTE_ADDR (*pml4e)) + PDPE (va);
+	if (!(*pdpe & PTE_P)) {
+		uint64_t *new_page = create ? palloc_get_page (PAL_ZERO) : NULL;
+		if (new_page == NULL)
+			return NULL;
+		*pdpe = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	return (uint64_t *) ptov (PTE_ADDR (*pdpe)) + PDX (va);
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,6 +149,8 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
+		if (((uint64_t) pte) & PTE_PS)
+			continue;
 		if (((uint64_t) pte) & PTE_P)
 			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
@@ -169,6 +198,9 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
+		/* The VM splits large pages before the frames go. */
+		if (((uint64_t) pte) & PTE_PS)
+			continue;
 		if (((uint64_t) pte) & PTE_P)
 			pt_destroy (PTE_ADDR (pte));
 	}
@@ -214,6 +246,10 @@ void *
 pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	ASSERT (is_user_vaddr (uaddr));
 
+	uint64_t *pde = pde_walk (pml4, (uint64_t) uaddr, false);
+	if (pde && (*pde & PTE_PS))
+		return ptov (PTE_ADDR (*pde)) + large_pg_ofs (uaddr);
+
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
 	if (pte && (*pte & PTE_P))
@@ -313,3 +349,75 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 			invlpg ((uint64_t) vpage);
 	}
 }
+
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+ * VPAGE in PML4, keeping its accessed and dirty bits. */
+void
+pml4_set_writable (uint64_t *pml4, const void *vpage, bool writable) {
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	if (pte) {
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint64_t) PTE_W;
+
+		if (rcr3 () == vtop (pml4))
+			invlpg ((uint64_t) vpage);
+	}
+}
+
+/* Maps the 2 MiB large page at user virtual address UPAGE to the
+ * physically contiguous frames at kernel virtual address KPAGE,
+ * with a single page directory entry. Both must be aligned to
+ * LARGE_PGSIZE. A page table left at UPAGE is freed, but only if
+ * it maps nothing. Returns true if successful, false if a page
+ * is mapped in the range or memory allocation failed. */
+bool
+pml4_set_large_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT (large_pg_ofs (upage) == 0);
+	ASSERT (large_pg_ofs (vtop (kpage)) == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	uint64_t *pde = pde_walk (pml4, (uint64_t) upage, true);
+	if (pde == NULL)
+		return false;
+	if (*pde & PTE_P) {
+		if (*pde & PTE_PS)
+			return false;
+		uint64_t *pt = ptov (PTE_ADDR (*pde));
+		for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+			if (pt[i] & PTE_P)
+				return false;
+		*pde = 0;
+		palloc_free_page (pt);
+	}
+	*pde = vtop (kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	if (rcr3 () == vtop (pml4))
+		invlpg ((uint64_t) upage);
+	return true;
+}
+
+/* Replaces the large page at UPAGE in PML4, if any, by a page
+ * table mapping the same frames 4 KiB at a time, with the same
+ * permissions, accessed and dirty bits. Returns false if memory
+ * allocation failed. */
+bool
+pml4_split_large_page (uint64_t *pml4, void *upage) {
+	ASSERT (large_pg_ofs (upage) == 0);
+
+	uint64_t *pde = pde_walk (pml4, (uint64_t) upage, false);
+	if (pde == NULL || !(*pde & PTE_PS))
+		return true;
+	uint64_t *pt = palloc_get_page (0);
+	if (pt == NULL)
+		return false;
+	uint64_t pa = PTE_ADDR (*pde);
+	uint64_t flags = *pde & (PTE_P | PTE_W | PTE_U | PTE_A | PTE_D);
+	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+		pt[i] = (pa + i * PGSIZE) | flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+	if (rcr3 () == vtop (pml4))
+		invlpg ((uint64_t) upage);
+	return true;
+}
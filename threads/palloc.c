@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -31,6 +32,7 @@ struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	size_t free_cnt;                /* Number of free pages. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -42,6 +44,7 @@ static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void adjust_free_cnt (struct pool *, long delta);
 
 /* multiboot info */
 struct multiboot_info {
@@ -224,11 +227,13 @@ split:
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				pool->free_cnt += page_cnt;
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				pool->free_cnt += page_cnt;
 			}
 		}
 	}
@@ -265,6 +270,8 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 
 	lock_acquire (&pool->lock);
 	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+	if (page_idx != BITMAP_ERROR)
+		adjust_free_cnt (pool, -(long) page_cnt);
 	lock_release (&pool->lock);
 	void *pages;
 
@@ -284,6 +291,37 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	return pages;
 }
 
+/* Project 3 */
+/* Like palloc_get_multiple, but the pages start at a physical
+   address that is a multiple of ALIGN_CNT pages. PAL_ASSERT is
+   not honored: large allocations are expected to fail. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt,
+		size_t align_cnt) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t pool_cnt = bitmap_size (pool->used_map);
+	size_t align = align_cnt * PGSIZE;
+	void *pages = NULL;
+
+	ASSERT (align_cnt > 0);
+	lock_acquire (&pool->lock);
+	uint64_t first = ROUND_UP (vtop (pool->base), align);
+	for (size_t idx = (first - vtop (pool->base)) / PGSIZE;
+			idx + page_cnt <= pool_cnt; idx += align_cnt)
+		if (bitmap_none (pool->used_map, idx, page_cnt)) {
+			bitmap_set_multiple (pool->used_map, idx, page_cnt, true);
+			adjust_free_cnt (pool, -(long) page_cnt);
+			pages = pool->base + PGSIZE * idx;
+			break;
+		}
+	lock_release (&pool->lock);
+
+	if (pages != NULL && (flags & PAL_ZERO))
+		memset (pages, 0, PGSIZE * page_cnt);
+	return pages;
+}
+/* Project 3 */
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -320,6 +358,7 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	adjust_free_cnt (pool, page_cnt);
 }
 
 /* Frees the page at PAGE. */
@@ -328,6 +367,30 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Project 3 */
+/* Returns the number of pages managed by the user pool. */
+size_t
+palloc_user_page_cnt (void) {
+	return bitmap_size (user_pool.used_map);
+}
+
+/* Returns the number of free pages in the user pool.  The count
+   is kept up to date by the allocator, so this is cheap enough to
+   call once per page. */
+size_t
+palloc_user_free_cnt (void) {
+	return user_pool.free_cnt;
+}
+
+/* Returns the index of PAGE within the user pool, counted from
+   the pool base.  PAGE must be a user pool page. */
+size_t
+palloc_user_page_idx (void *page) {
+	ASSERT (page_from_pool (&user_pool, page));
+	return pg_no (page) - pg_no (user_pool.base);
+}
+/* Project 3 */
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
@@ -347,6 +410,16 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
 	*bm_base += bm_pages;
 }
 
+/* Adds DELTA to the free page count of POOL.  Pages are freed
+   without the pool lock, so the count is updated with interrupts
+   off instead. */
+static void
+adjust_free_cnt (struct pool *pool, long delta) {
+	enum intr_level old_level = intr_disable ();
+	pool->free_cnt += delta;
+	intr_set_level (old_level);
+}
+
 /* Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool
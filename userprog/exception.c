@@ -11,6 +11,7 @@ static long long page_fault_cnt;
 
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+static void inspect_page_fault_cnt (struct intr_frame *);
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -58,6 +59,11 @@ exception_init (void) {
 	   We need to disable interrupts for page faults because the
 	   fault address is stored in CR2 and needs to be preserved. */
 	intr_register_int (14, 0, INTR_OFF, page_fault, "#PF Page-Fault Exception");
+
+	/* Project 3 */
+	intr_register_int (0x45, 3, INTR_OFF, inspect_page_fault_cnt,
+			"Inspect Page Fault Count");
+	/* Project 3 */
 }
 
 /* Prints exception statistics. */
@@ -140,15 +146,15 @@ page_fault (struct intr_frame *f) {
 	write = (f->error_code & PF_W) != 0;
 	user = (f->error_code & PF_U) != 0;
 
+	/* Count page faults. */
+	page_fault_cnt++;
+
 #ifdef VM
 	/* For project 3 and later. */
 	if (vm_try_handle_fault (f, fault_addr, user, write, not_present))
 		return;
 	exit(-1);
 #endif
-	
-	/* Count page faults. */
-	page_fault_cnt++;
 
 	/* If the fault is true fault, show info and exit. */
 	printf ("Page fault at %p: %s error %s page in %s context.\n",
@@ -159,3 +165,10 @@ page_fault (struct intr_frame *f) {
 	exit(-1);
 }
 
+/* Tool for testing page replacement. Calling this function via int 0x45.
+ * Output:
+ *   @RAX - Number of page faults processed so far. */
+static void
+inspect_page_fault_cnt (struct intr_frame *f) {
+	f->R.rax = page_fault_cnt;
+}
@@ -20,6 +20,7 @@
 #include "intrinsic.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/vma.h"
 #endif
 
 /* Project 2 */
@@ -189,12 +190,8 @@ __do_fork (void *aux) {
 	process_activate (current);
 #ifdef VM
 	supplemental_page_table_init (&current->spt);
-	sema_down(&sys_sema);
-	if (!supplemental_page_table_copy (&current->spt, &parent->spt)){
-		sema_up(&sys_sema);
+	if (!supplemental_page_table_copy (&current->spt, &parent->spt))
 		goto error;
-	}
-	sema_up(&sys_sema);
 #else
 	if (!pml4_for_each (parent->pml4, duplicate_pte, parent))
 		goto error;
@@ -348,6 +345,10 @@ process_exit (void) {
 	}
 	file_close(curr->elf);
 	palloc_free_page(curr->fdt);
+#ifdef VM
+	if (vm_stats_on_exit)
+		vm_print_thread_stats (curr);
+#endif
 	process_cleanup ();
 	sema_up(&curr->parent_wait);
 	sema_down(&curr->child_wait);
@@ -779,31 +780,26 @@ lazy_load_segment (struct page *page, void *aux) {
 	/* TODO: This called when the first page fault occurs on address VA. */
 	/* TODO: VA is available when calling this function. */
 	/* Project 3 */
-	struct load_info * info = (struct load_info *)aux;
-	struct file *file = info->file;
-	uint32_t read_bytes = info->page_read_bytes;
-	uint32_t zero_bytes = info->page_zero_bytes;
+	/* AUX is the area holding PAGE. */
+	struct vma *vma = aux;
+	struct file *file = vma->file;
+	uint32_t read_bytes = vma_page_read_bytes (vma, page->va);
+	uint32_t zero_bytes = PGSIZE - read_bytes;
 	struct frame *frame = page->frame;
-	page->mmap_id = info->mmap_id;
 
-	off_t ofs = info->ofs;
+	off_t ofs = vma_page_ofs (vma, page->va);
 
-	file_seek (file, ofs);	/* Load this page. */
-	if (file_read (file, frame->kva, read_bytes) != (int) read_bytes) {
-		palloc_free_page (frame->kva);
-		free(aux);
+	if (file_read_at (file, frame->kva, read_bytes, ofs) != (int) read_bytes) {
 		return false;
 	}
 	memset (frame->kva + read_bytes, 0, zero_bytes);
 	if (page_get_type(page) == VM_FILE){
 		page->file.file = file;
+		page->file.vma = vma;
 		page->file.ofs = ofs;
 		page->file.page_read_bytes = read_bytes;
 		page->file.page_zero_bytes = zero_bytes;
 	}
-
-
-	free(aux);
 	return true;
 	/* Project 3 */
 }
@@ -829,35 +825,18 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
-	file_seek(file, ofs);
-	while (read_bytes > 0 || zero_bytes > 0) {
-		/* Do calculate how to fill this page.
-		 * We will read PAGE_READ_BYTES bytes from FILE
-		 * and zero the final PAGE_ZERO_BYTES bytes. */
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		/* Project 3 */
-		struct load_info * info = malloc(sizeof(struct load_info));
-		info->file = file;
-		info->ofs = ofs;
-		info->page_read_bytes = page_read_bytes;
-		info->page_zero_bytes = page_zero_bytes;
-		void *aux = info;
-		/* Project 3 */
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux)){
-			free(aux);
-			return false;
-		}
-		/* Advance. */
-		read_bytes -= page_read_bytes;
-		zero_bytes -= page_zero_bytes;
-		upage += PGSIZE;
-		ofs += page_read_bytes;
-	}
+	/* Project 3 */
+	/* The pages are created by the fault handler, from the area. Pages of
+	 * read-only segments are file backed, so that they are shared through
+	 * the text cache and dropped on eviction instead of swapped out. */
+	struct vma *vma = vma_map (&thread_current ()->spt, upage,
+			read_bytes + zero_bytes, writable ? VM_ANON : VM_FILE, writable,
+			file, ofs, read_bytes);
+	if (vma == NULL)
+		return false;
+	vma->exec = true;
 	return true;
+	/* Project 3 */
 }
 
 /* Create a PAGE of stack at the USER_STACK. Return true on success. */
@@ -871,10 +850,14 @@ setup_stack (struct intr_frame *if_) {
 	 * TODO: You should mark the page is stack. */
 	/* TODO: Your code goes here */
 	/* Project 3 */
-	if(vm_alloc_page(VM_ANON | VM_MARKER_0, stack_bottom, true) && (vm_claim_page(stack_bottom))){
-		if_->rsp = USER_STACK;
-		thread_current()->stack_bottom = stack_bottom;
-		success = true;
+	/* The stack is an area that vm_stack_growth extends down. */
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	if (vma_map (spt, stack_bottom, PGSIZE, VM_ANON | VM_MARKER_0, true, NULL, 0, 0) != NULL) {
+		struct page *page = spt_get_page (spt, stack_bottom);
+		if (page != NULL && vm_claim_page (stack_bottom)) {
+			if_->rsp = USER_STACK;
+			success = true;
+		}
 	}
 	/* Project 3 */
 	return success;
@@ -1,4 +1,5 @@
 #include "userprog/syscall.h"
+#include <limits.h>
 #include <stdio.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
@@ -47,6 +48,9 @@ bool check_addr(void *addr);
 /* Project 3 */
 void * mmap(void * addr, size_t length, int writable, int fd, off_t offset);
 void munmap(void * addr);
+int madvise(void * addr, size_t length, int advice);
+int msync(void * addr, size_t length, int flags);
+int shm_create(size_t size);
 /* Project 3 */
 
 /* System call.
@@ -138,6 +142,15 @@ syscall_handler (struct intr_frame *f) {
 		case SYS_MUNMAP:
 			munmap(f->R.rdi);
 			break;
+		case SYS_MADVISE:
+			f->R.rax = madvise(f->R.rdi, f->R.rsi, f->R.rdx);
+			break;
+		case SYS_MSYNC:
+			f->R.rax = msync(f->R.rdi, f->R.rsi, f->R.rdx);
+			break;
+		case SYS_SHM_CREATE:
+			f->R.rax = shm_create(f->R.rdi);
+			break;
 		/* Project 3 */
 		default:
 			exit(-1);
@@ -250,8 +263,8 @@ int read (int fd, void *buffer, unsigned size) {
 
 	void * buf = buffer;
 	while(buf < buffer + size){
-		struct page * bufpage =spt_find_page(&thread_current()->spt, buf);
-		if(bufpage->writable == false){
+		struct page * bufpage =spt_get_page(&thread_current()->spt, buf);
+		if(bufpage == NULL || bufpage->writable == false){
 			exit(-1);
 		}
 		buf += PGSIZE;
@@ -358,7 +371,7 @@ bool check_addr (void* addr){
 	}
 	else if(pml4_get_page(thread_current()->pml4, addr) == NULL){
 		#ifdef VM
-			if(spt_find_page(&thread_current()->spt, addr) != NULL){
+			if(spt_get_page(&thread_current()->spt, addr) != NULL){
 				return true;
 			}
 		#endif
@@ -408,7 +421,8 @@ void * mmap(void * addr, size_t length, int writable, int fd, off_t offset){
 		return NULL;
 	}
 
-	if(spt_find_page(&thread_current()->spt, addr) != NULL){
+	/* Areas are checked by do_mmap, this keeps the stack room to grow. */
+	if((uintptr_t) addr < USER_STACK && (uintptr_t) addr + length > USER_STACK - STACK_LIMIT){
 		return NULL;
 	}
 	
@@ -419,9 +433,54 @@ void munmap(void * addr){
 	if((addr == NULL) || (is_user_vaddr(addr) == false) || (addr != pg_round_down(addr))){
 		return NULL;
 	}
-	struct page * page = spt_find_page(&thread_current()->spt, addr);
-	if(page_get_type(page) == VM_FILE){
-		do_munmap(addr);
+	do_munmap(addr);
+}
+
+int madvise(void * addr, size_t length, int advice){
+	if((addr == NULL) || (is_user_vaddr(addr) == false) || (addr != pg_round_down(addr))){
+		return -1;
+	}
+	if(length == 0 || length > KERN_BASE - (uintptr_t) addr){
+		return -1;
+	}
+	return vm_madvise(addr, length, advice) ? 0 : -1;
+}
+
+int msync(void * addr, size_t length, int flags){
+	if((addr == NULL) || (is_user_vaddr(addr) == false) || (addr != pg_round_down(addr))){
+		return -1;
+	}
+	if(length == 0 || length > KERN_BASE - (uintptr_t) addr){
+		return -1;
+	}
+	if(flags != MS_ASYNC && flags != MS_SYNC){
+		return -1;
+	}
+	return do_msync(addr, length, flags) ? 0 : -1;
+}
+
+/* Create an anonymous shared memory segment of SIZE bytes, zeroed, and
+ * return a descriptor for it. Processes map it with mmap and MAP_SHARED,
+ * and so share its frames, and children inherit the descriptor. Its
+ * pages are evicted to the segment itself, a file with no name that goes
+ * away with its last descriptor and mapping. */
+int shm_create(size_t size){
+	if(size == 0 || size > INT_MAX){
+		return -1;
+	}
+	sema_down(&sys_sema);
+	struct file *f = filesys_create_anonymous(size);
+	sema_up(&sys_sema);
+	if(f == NULL){
+		return -1;
 	}
+	for(int i = 0; i < FDT_SIZE; i++){
+		if(thread_current()->fdt[i] == NULL){
+			thread_current()->fdt[i] = f;
+			return i;
+		}
+	}
+	file_close(f);
+	return -1;
 }
 /* Project 3 */
\ No newline at end of file
@@ -2,10 +2,45 @@
 
 #include "vm/vm.h"
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
 
 /* Projcet 3 */
 #include <bitmap.h>
-struct bitmap *swap_table;
+#include <stdio.h>
+#include "vm/swap.h"
+#include "vm/trace.h"
+#include "vm/vma.h"
+#include "vm/writeback.h"
+
+#define SECTORS_PER_PAGE (PGSIZE / DISK_SECTOR_SIZE)
+
+/* The last pages swapped out and their slots, so that a page can go
+ * right after its predecessor in the address space. */
+#define SWAP_HINT_CNT 8
+static struct swap_hint {
+	uint64_t *pml4;
+	void *va;
+	size_t idx;
+} swap_hints[SWAP_HINT_CNT];
+static size_t swap_hint_next;
+
+/* Readahead statistics. */
+static long long ra_read_cnt;		/* Pages read ahead. */
+static long long ra_hit_cnt;		/* Of those, pages used before the next fault. */
+static long long ra_waste_cnt;		/* Of those, pages not used. */
+
+static void anon_swap_out_finish (struct page *page, size_t idx);
+static bool anon_evict_clean (struct page *page);
+static void readahead_adjust (struct anon_readahead *ra, struct page *page);
+static size_t readahead_frames (struct page *page, size_t window,
+		struct page *pages[]);
+static void swap_read_run (size_t idx, void *kva, struct page *pages[],
+		size_t cnt);
+static size_t swap_hint (struct page *page);
+static void swap_hint_record (struct page *page, size_t idx);
+static void sort_by_address (struct page *pages[], size_t cnt);
 /* Project 3 */
 
 /* DO NOT MODIFY BELOW LINE */
@@ -27,8 +62,7 @@ void
 vm_anon_init (void) {
 	/* TODO: Set up the swap_disk. */
 	swap_disk = disk_get(1, 1);
-	// 8 sectors allocated for each page
-	swap_table = bitmap_create(disk_size(swap_disk) / 8);
+	swap_init(swap_disk != NULL ? disk_size(swap_disk) / SECTORS_PER_PAGE : 0);
 }
 
 /* Initialize the file mapping */
@@ -38,34 +72,327 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->idx = BITMAP_ERROR;
+	return true;
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Swap in the page by read contents from the swap disk. The following
+ * pages of the process whose slots follow PAGE's on the disk come along
+ * in the same disk command, up to the process's readahead window. They
+ * keep their slots, so dropping them again is free while they are not
+ * written. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
-	for(int i = 0; i < 8; i++){
-		disk_read(swap_disk, page->anon.idx * 8 + i, page->frame->kva + DISK_SECTOR_SIZE * i);
+	struct anon_readahead *ra = &thread_current()->swap_ra;
+	struct page *pages[ANON_READAHEAD_MAX];
+	size_t idx = page->anon.idx;
+
+	readahead_adjust(ra, page);
+	size_t window = ra->window;
+	struct vma *vma = vma_find(&thread_current()->spt, page->va);
+	if(vma != NULL && vma->advice == MADV_RANDOM){
+		window = 0;
+	}
+	else if(vma != NULL && vma->advice == MADV_SEQUENTIAL){
+		window = ANON_READAHEAD_MAX;
+	}
+	size_t cnt = readahead_frames(page, window, pages);
+	uint64_t start = vm_trace_begin();
+	swap_read_run(idx, kva, pages, cnt);
+	vm_trace_end(TRACE_SWAP_IN, start, page->va);
+	swap_unref(idx);
+	page->anon.idx = BITMAP_ERROR;
+
+	for(size_t i = 0; i < cnt; i++){
+		struct frame *frame = pages[i]->frame;
+		if(pml4_set_page(pages[i]->pml4, pages[i]->va, frame->kva, pages[i]->writable)){
+			vm_unpin_frame(frame->kva);
+		}
+		else{
+			vm_free_frame(frame);
+		}
 	}
-	bitmap_flip(swap_table, page->anon.idx);
+	ra->start = page->va + PGSIZE;
+	ra->cnt = cnt;
+	ra_read_cnt += cnt;
 	return true;
 }
 
-/* Swap out the page by writing contents to the swap disk. */
+/* Score the pages read ahead by the previous fault of the process, and
+ * resize its window: doubled if at least half of them have been used,
+ * halved otherwise. A fault right after the previous one opens it. */
+static void
+readahead_adjust (struct anon_readahead *ra, struct page *page) {
+	if(ra->cnt > 0){
+		size_t hits = 0;
+		for(size_t i = 0; i < ra->cnt; i++){
+			struct page *p = spt_find_page(&thread_current()->spt, ra->start + i * PGSIZE);
+			if(p != NULL && p->frame != NULL && pml4_is_accessed(p->pml4, p->va)){
+				hits++;
+			}
+		}
+		ra_hit_cnt += hits;
+		ra_waste_cnt += ra->cnt - hits;
+		if(hits * 2 >= ra->cnt){
+			ra->window = ra->window * 2 < ANON_READAHEAD_MAX ? ra->window * 2 : ANON_READAHEAD_MAX;
+		}
+		else{
+			ra->window /= 2;
+		}
+		ra->cnt = 0;
+	}
+	else if(ra->window == 0 && page->va == ra->last_va + PGSIZE){
+		ra->window = 1;
+	}
+	ra->last_va = page->va;
+}
+
+/* Gets frames for up to WINDOW pages following PAGE that are swapped out
+ * to the slots following PAGE's, and stores the pages in PAGES. Only
+ * free frames are taken, while the writeback daemon would not have to
+ * reclaim them. The frames are pinned. Returns the number of pages. */
+static size_t
+readahead_frames (struct page *page, size_t window, struct page *pages[]) {
+	size_t cnt = 0;
+	while(cnt < window){
+		struct page *next = spt_find_page(&thread_current()->spt, page->va + (cnt + 1) * PGSIZE);
+		if(next == NULL || VM_TYPE(next->operations->type) != VM_ANON || next->frame != NULL
+				|| next->anon.idx != page->anon.idx + cnt + 1){
+			break;
+		}
+		/* A guess must never cost an eviction. */
+		if(palloc_user_free_cnt() <= writeback_low_pages){
+			break;
+		}
+		struct frame *frame = vm_alloc_frame();
+		if(frame == NULL){
+			break;
+		}
+		frame->page = next;
+		next->frame = frame;
+		pages[cnt++] = next;
+	}
+	return cnt;
+}
+
+/* Reads swap slot IDX into KVA and the CNT following slots into the
+ * frames of PAGES, with a single disk command. This is apart from
+ * anon_swap_in so that the sector vector is only on the stack once all
+ * the frames are there, and never under the eviction getting them can
+ * run. */
+static void NO_INLINE
+swap_read_run (size_t idx, void *kva, struct page *pages[], size_t cnt) {
+	void *sectors[(ANON_READAHEAD_MAX + 1) * SECTORS_PER_PAGE];
+
+	for(size_t j = 0; j < SECTORS_PER_PAGE; j++){
+		sectors[j] = kva + DISK_SECTOR_SIZE * j;
+	}
+	for(size_t i = 0; i < cnt; i++){
+		for(size_t j = 0; j < SECTORS_PER_PAGE; j++){
+			sectors[(i + 1) * SECTORS_PER_PAGE + j] = pages[i]->frame->kva + DISK_SECTOR_SIZE * j;
+		}
+	}
+	disk_read_vector(swap_disk, idx * SECTORS_PER_PAGE, sectors, (cnt + 1) * SECTORS_PER_PAGE);
+}
+
+/* Swap out the page by writing contents to the swap disk. A page the
+ * writeback daemon has already written, and that is still clean, needs
+ * no write at all. A dirty page only reuses its slot if no other page
+ * shares it, as a page read ahead may after fork. PAGE must be busy and
+ * unmapped. */
 static bool
 anon_swap_out (struct page *page) {
-	page->anon.idx = bitmap_scan_and_flip(swap_table, 0, 1, false);
-	if(page->anon.idx == BITMAP_ERROR){
+	if(anon_evict_clean(page)){
+		anon_swap_out_finish(page, page->anon.idx);
+		return true;
+	}
+	size_t idx = page->anon.idx;
+	if(idx == BITMAP_ERROR || vm_phys_frame(page->frame->kva)->cpy_cnt > 0
+			|| swap_ref_cnt(idx) > 1){
+		idx = swap_alloc(1, swap_hint(page));
+	}
+	if(idx == BITMAP_ERROR){
+		return false;
+	}
+	uint64_t start = vm_trace_begin();
+	disk_write_multiple(swap_disk, idx * SECTORS_PER_PAGE, page->frame->kva, SECTORS_PER_PAGE);
+	vm_trace_end(TRACE_SWAP_OUT, start, page->va);
+	anon_swap_out_finish(page, idx);
+	return true;
+}
+
+/* Swap out CNT pages at once. Clean pages are dropped right away, and
+ * the others get adjacent swap slots, in address order, when a free run
+ * is long enough, so they all go out with a single disk command. Otherwise each one is
+ * swapped out on its own. EVICTED[i] is set to whether ALL_PAGES[i] has
+ * been swapped out; the ones that could not be stay resident. The pages
+ * must be busy and unmapped. Returns true if every page has been
+ * swapped out. */
+bool
+anon_swap_out_multiple (struct page *all_pages[], bool evicted[], size_t all_cnt) {
+	const void *sectors[ANON_SWAP_BATCH * SECTORS_PER_PAGE];
+	struct page *pages[ANON_SWAP_BATCH];
+	size_t cnt = 0;
+
+	ASSERT(all_cnt <= ANON_SWAP_BATCH);
+	for(size_t i = 0; i < all_cnt; i++){
+		evicted[i] = true;
+		if(anon_evict_clean(all_pages[i])){
+			anon_swap_out_finish(all_pages[i], all_pages[i]->anon.idx);
+		}
+		else{
+			pages[cnt++] = all_pages[i];
+		}
+	}
+	if(cnt == 0){
+		return true;
+	}
+
+	sort_by_address(pages, cnt);
+	size_t idx = swap_alloc(cnt, swap_hint(pages[0]));
+	if(idx == BITMAP_ERROR){
+		bool success = true;
+		for(size_t i = 0; i < all_cnt; i++){
+			if(!anon_evict_clean(all_pages[i]) && !anon_swap_out(all_pages[i])){
+				evicted[i] = success = false;
+			}
+		}
+		return success;
+	}
+	for(size_t i = 0; i < cnt; i++){
+		for(size_t j = 0; j < SECTORS_PER_PAGE; j++){
+			sectors[i * SECTORS_PER_PAGE + j] = pages[i]->frame->kva + DISK_SECTOR_SIZE * j;
+		}
+	}
+	uint64_t start = vm_trace_begin();
+	disk_write_vector(swap_disk, idx * SECTORS_PER_PAGE, sectors, cnt * SECTORS_PER_PAGE);
+	vm_trace_end(TRACE_SWAP_OUT, start, pages[0]->va);
+	for(size_t i = 0; i < cnt; i++){
+		anon_swap_out_finish(pages[i], idx + i);
+	}
+	return true;
+}
+
+/* PAGE's contents are now in swap slot IDX. Every page sharing the frame
+ * after fork now shares the slot, and each of them reads back its own
+ * private copy on the next fault. A stale slot a sharer was still holding
+ * is released. */
+static void
+anon_swap_out_finish (struct page *page, size_t idx) {
+	struct phys_frame *pf = vm_phys_frame(page->frame->kva);
+	for(struct list_elem * e = list_begin(&pf->rmap); e != list_end(&pf->rmap); e = list_next(e)){
+		struct page *sharer = list_entry(e, struct frame, rmap_elem)->page;
+		if(sharer == NULL || sharer->anon.idx == idx){
+			continue;
+		}
+		if(sharer->anon.idx != BITMAP_ERROR){
+			swap_unref(sharer->anon.idx);
+		}
+		sharer->anon.idx = idx;
+		swap_ref(idx);
+	}
+	swap_hint_record(page, idx);
+}
+
+/* Write resident PAGE to swap ahead of eviction, so that evicting it
+ * later needs no write while it stays clean. PAGE keeps the slot until it
+ * is swapped in again or destroyed. Frames shared after fork are left to
+ * eviction. Returns true if a write was done. PAGE must be busy. */
+bool
+anon_writeback (struct page *page) {
+	struct anon_page *anon_page = &page->anon;
+
+	if(vm_phys_frame(page->frame->kva)->cpy_cnt > 0 || anon_is_clean(page)){
 		return false;
 	}
-	for(int i = 0; i < 8; i++){
-		disk_write(swap_disk, page->anon.idx * 8 + i, page->va + DISK_SECTOR_SIZE * i);
+	if(anon_page->idx != BITMAP_ERROR && swap_ref_cnt(anon_page->idx) > 1){
+		/* Other pages still read their contents from the slot. */
+		swap_unref(anon_page->idx);
+		anon_page->idx = BITMAP_ERROR;
 	}
-	pml4_clear_page(thread_current()->pml4, page->va);
+	if(anon_page->idx == BITMAP_ERROR){
+		size_t idx = swap_alloc(1, swap_hint(page));
+		if(idx == BITMAP_ERROR){
+			return false;
+		}
+		anon_page->idx = idx;
+		swap_ref(idx);
+		swap_hint_record(page, idx);
+	}
+	/* Clear first: a write racing with the disk write dirties it again. */
+	pml4_set_dirty(page->pml4, page->va, false);
+	disk_write_multiple(swap_disk, anon_page->idx * SECTORS_PER_PAGE, page->frame->kva, SECTORS_PER_PAGE);
 	return true;
 }
 
+/* Returns true if resident PAGE has an up-to-date copy in its swap slot. */
+bool
+anon_is_clean (struct page *page) {
+	return page->anon.idx != BITMAP_ERROR
+		&& vm_phys_frame(page->frame->kva)->cpy_cnt == 0
+		&& !pml4_is_dirty(page->pml4, page->va);
+}
+
+/* Returns true if PAGE, busy and unmapped for eviction, has an
+ * up-to-date copy in its swap slot. vm_frame_unmap_all took the dirty
+ * bits of the frame's mappings. */
+static bool
+anon_evict_clean (struct page *page) {
+	struct phys_frame *pf = vm_phys_frame(page->frame->kva);
+	return page->anon.idx != BITMAP_ERROR && pf->cpy_cnt == 0 && !pf->dirty;
+}
+
+/* Prints readahead statistics. */
+void
+anon_print_stats (void) {
+	printf("Swap readahead: %lld pages read ahead, %lld hits, %lld wasted\n",
+			ra_read_cnt, ra_hit_cnt, ra_waste_cnt);
+}
+
+/* Returns the slot right after the one PAGE's predecessor in its address
+ * space was recently swapped out to, or BITMAP_ERROR. */
+static size_t
+swap_hint (struct page *page) {
+	for(size_t i = 0; i < SWAP_HINT_CNT; i++){
+		struct swap_hint *hint = &swap_hints[i];
+		if(hint->pml4 == page->pml4 && hint->va + PGSIZE == page->va){
+			return hint->idx + 1;
+		}
+	}
+	return BITMAP_ERROR;
+}
+
+/* Remember that PAGE went to slot IDX. */
+static void
+swap_hint_record (struct page *page, size_t idx) {
+	struct swap_hint *hint = &swap_hints[swap_hint_next];
+	hint->pml4 = page->pml4;
+	hint->va = page->va;
+	hint->idx = idx;
+	swap_hint_next = (swap_hint_next + 1) % SWAP_HINT_CNT;
+}
+
+/* Sort CNT PAGES by address space, then by address. */
+static void
+sort_by_address (struct page *pages[], size_t cnt) {
+	for(size_t i = 1; i < cnt; i++){
+		struct page *page = pages[i];
+		size_t j = i;
+		for(; j > 0 && (pages[j - 1]->pml4 > page->pml4
+				|| (pages[j - 1]->pml4 == page->pml4 && pages[j - 1]->va > page->va)); j--){
+			pages[j] = pages[j - 1];
+		}
+		pages[j] = page;
+	}
+}
+
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	/* Project 3 */
+	if(anon_page->idx != BITMAP_ERROR){
+		swap_unref(anon_page->idx);
+	}
+	/* Project 3 */
 }
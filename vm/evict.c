@@ -0,0 +1,162 @@
+/* evict.c: Page replacement policies.
+ *
+ * The user pool is treated as a circular array of phys_frame, one per user
+ * page, and each policy sweeps it with a persistent hand. A phys_frame is
+ * resident while its rmap is not empty. */
+
+#include "vm/vm.h"
+#include "vm/evict.h"
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/palloc.h"
+
+/* A frame not referenced for more than this many ticks has left the
+ * working set, for WSClock. */
+#define WSCLOCK_TAU 50
+
+/* -evict=POLICY */
+const char *evict_policy_name = "clock";
+
+static const struct evict_policy *policy;
+static size_t frame_cnt;	/* Size of the circular array. */
+static size_t hand;			/* Persistent clock hand. */
+
+/* Statistics. */
+static long long evict_cnt;		/* Number of victims chosen. */
+static long long scan_cnt;		/* Number of resident frames looked at. */
+
+static struct frame *evictable_frame (struct phys_frame *pf);
+static struct frame *clock_get_victim (void);
+static struct frame *wsclock_get_victim (void);
+
+static const struct evict_policy policies[] = {
+	{ .name = "clock", .get_victim = clock_get_victim },
+	{ .name = "wsclock", .get_victim = wsclock_get_victim },
+};
+
+/* Select the policy named by evict_policy_name. */
+void
+vm_evict_init (void) {
+	frame_cnt = palloc_user_page_cnt ();
+	hand = 0;
+	for (size_t i = 0; i < sizeof policies / sizeof *policies; i++)
+		if (!strcmp (policies[i].name, evict_policy_name))
+			policy = &policies[i];
+	if (policy == NULL)
+		PANIC ("unknown eviction policy `%s'", evict_policy_name);
+}
+
+/* Pick the frame to evict with the policy in use. */
+struct frame *
+vm_evict_get_victim (void) {
+	struct frame *victim = policy->get_victim ();
+	if (victim != NULL)
+		evict_cnt++;
+	return victim;
+}
+
+/* Stores in FRAMES up to CNT of the next evictable frames the hand will
+ * reach, without moving it. Returns the number of frames stored. The
+ * frame lock must be held. */
+size_t
+vm_evict_scan_ahead (struct frame *frames[], size_t cnt) {
+	size_t found = 0;
+	for (size_t i = 0; i < frame_cnt && found < cnt; i++) {
+		struct frame *frame = evictable_frame (
+				vm_phys_frame_at ((hand + i) % frame_cnt));
+		if (frame != NULL)
+			frames[found++] = frame;
+	}
+	return found;
+}
+
+/* Prints eviction statistics. */
+void
+vm_evict_print_stats (void) {
+	printf ("Evict: %s policy, %lld evictions, %lld frames scanned\n",
+			policy->name, evict_cnt, scan_cnt);
+}
+
+/* Returns the frame PF can be evicted through, or NULL if PF is free,
+ * pinned or still being set up. */
+static struct frame *
+evictable_frame (struct phys_frame *pf) {
+	if (list_empty (&pf->rmap) || pf->pin_cnt > 0)
+		return NULL;
+	struct frame *frame = list_entry (list_front (&pf->rmap),
+			struct frame, rmap_elem);
+	return frame->page != NULL ? frame : NULL;
+}
+
+/* Returns the phys_frame under the hand and moves the hand forward. */
+static struct phys_frame *
+advance_hand (void) {
+	struct phys_frame *pf = vm_phys_frame_at (hand);
+	hand = (hand + 1) % frame_cnt;
+	return pf;
+}
+
+/* Folds the accessed bits of every mapper into PF's referenced bit and
+ * returns it, clearing both. */
+static bool
+test_and_clear_referenced (struct phys_frame *pf, struct frame *frame) {
+	bool referenced = vm_frame_test_and_clear_accessed (frame);
+	referenced = referenced || pf->referenced;
+	pf->referenced = false;
+	return referenced;
+}
+
+/* Second chance: a referenced frame loses its bit and is skipped. After
+ * one full turn every bit is clear, so two turns always find a victim. */
+static struct frame *
+clock_get_victim (void) {
+	for (size_t i = 0; i < 2 * frame_cnt; i++) {
+		struct phys_frame *pf = advance_hand ();
+		struct frame *frame = evictable_frame (pf);
+		if (frame == NULL)
+			continue;
+		scan_cnt++;
+		if (!test_and_clear_referenced (pf, frame))
+			return frame;
+	}
+	return NULL;
+}
+
+/* WSClock: like clock, but only frames that left the working set are
+ * candidates, and clean ones are preferred since they need no write. */
+static struct frame *
+wsclock_get_victim (void) {
+	struct frame *dirty_victim = NULL;
+	struct frame *old_victim = NULL;
+	int64_t now = timer_ticks ();
+
+	for (size_t i = 0; i < frame_cnt; i++) {
+		struct phys_frame *pf = advance_hand ();
+		struct frame *frame = evictable_frame (pf);
+		if (frame == NULL)
+			continue;
+		scan_cnt++;
+		if (test_and_clear_referenced (pf, frame)) {
+			pf->last_used = now;
+			continue;
+		}
+		if (old_victim == NULL)
+			old_victim = frame;
+		if (now - pf->last_used <= WSCLOCK_TAU)
+			continue;
+		if (page_get_type (frame->page) == VM_ANON)
+			pf->dirty = !anon_is_clean (frame->page);
+		else
+			pf->dirty = vm_frame_is_dirty (frame);
+		if (!pf->dirty)
+			return frame;
+		if (dirty_victim == NULL)
+			dirty_victim = frame;
+	}
+	if (dirty_victim != NULL)
+		return dirty_victim;
+	if (old_victim != NULL)
+		return old_victim;
+	return clock_get_victim ();
+}
@@ -2,13 +2,35 @@
 
 #include "vm/vm.h"
 /* Project 3 */
+#include <bitmap.h>
+#include <round.h>
+#include <string.h>
+#include "threads/mmu.h"
 #include "threads/vaddr.h"
 #include "userprog/process.h"
+#include "vm/vma.h"
+#include "vm/writeback.h"
+
+/* Maximum number of pages written back by one file write. */
+#define FLUSH_BATCH 16
+
+/* Dirty pages of an area, adjacent in its file, written back together. */
+struct flush_run {
+	struct vma *vma;
+	void *upage;				/* First page */
+	size_t cnt;					/* Number of pages */
+	off_t bytes;				/* Bytes to write, the last page may be partial */
+	void *kvas[FLUSH_BATCH];	/* Their frames, pinned */
+};
 /* Project 3 */
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
 static void file_backed_destroy (struct page *page);
+/* Project 3 */
+static void *flush_page (struct supplemental_page_table *spt, void *upage);
+static bool flush_run_write (struct flush_run *run, void *buf);
+/* Project 3 */
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations file_ops = {
@@ -44,7 +66,6 @@ file_backed_swap_in (struct page *page, void *kva) {
 
 	file_seek (file, ofs);	/* Load this page. */
 	if (file_read (file, kva, read_bytes) != (int) read_bytes) {
-		palloc_free_page (kva);
 		return false;
 	}
 	memset (kva + read_bytes, 0, zero_bytes);
@@ -56,16 +77,201 @@ static bool
 file_backed_swap_out (struct page *page) {
 	struct file_page *file_page = &page->file;
 	/* Project 3 */
-	if(pml4_is_dirty(thread_current()->pml4, page->va)){
+	/* A dirty page is written back once, whichever sharer dirtied it. */
+	if(vm_phys_frame(page->frame->kva)->dirty){
 		file_write_at(file_page->file, page->frame->kva, file_page->page_read_bytes, file_page->ofs);
-		pml4_set_dirty (thread_current()->pml4, page->va, 0);
 	}
-	pml4_clear_page(thread_current()->pml4, page->va);
-	page->frame = NULL;
 	return true;
 	/* Project 3 */
 }
 
+/* Write resident PAGE back to its file ahead of eviction, leaving it
+ * mapped. Returns true if a write was done. PAGE must be busy. */
+bool
+file_backed_writeback (struct page *page) {
+	struct file_page *file_page = &page->file;
+	/* Project 3 */
+	/* Clear first: a write racing with the file write dirties it again. */
+	if(!vm_frame_test_and_clear_dirty(page->frame)){
+		return false;
+	}
+	file_write_at(file_page->file, page->frame->kva, file_page->page_read_bytes, file_page->ofs);
+	return true;
+	/* Project 3 */
+}
+
+/* Writable mmaps track the pages written since their last writeback in
+ * a dirty set, a bitmap of their area. A page out of the set is mapped
+ * read-only, so that its first write faults and puts it in, and a flush
+ * only has to look at the pages in the set. */
+
+/* Returns true if PAGE, writable and loaded, may be mapped writable. */
+bool
+file_backed_writable (struct page *page) {
+	/* Project 3 */
+	struct vma *vma = page->file.vma;
+	return vma->dirty == NULL
+		|| bitmap_test(vma->dirty, (page->va - vma->start) / PGSIZE);
+	/* Project 3 */
+}
+
+/* Put the page at UPAGE in the dirty set of its area, if it has one, on
+ * a write to it. Returns false if a large page over it could not be
+ * split. SPT must be locked. */
+bool
+file_backed_mark_dirty (struct supplemental_page_table *spt, void *upage) {
+	/* Project 3 */
+	struct vma *vma = vma_find(spt, upage);
+	if(vma == NULL || vma->dirty == NULL){
+		return true;
+	}
+	/* Large pages of a writable mmap are mapped read-only. */
+	if(!vm_huge_split(spt, pg_round_down(upage), pg_round_down(upage) + PGSIZE)){
+		return false;
+	}
+	bitmap_mark(vma->dirty, (upage - vma->start) / PGSIZE);
+	return true;
+	/* Project 3 */
+}
+
+/* Write the dirty pages of SPT's mmaps in [START, END) back to their
+ * files, and take them out of the dirty sets. Runs of pages adjacent in
+ * a file go out in a single write of up to FLUSH_BATCH pages. Returns
+ * false if a write failed. SPT must be locked. */
+bool
+file_backed_flush (struct supplemental_page_table *spt, void *start, void *end) {
+	/* Project 3 */
+	if(!vm_huge_split(spt, start, end)){
+		return false;
+	}
+	/* Without a bounce buffer, runs are written a page at a time. */
+	void *buf = palloc_get_multiple(0, FLUSH_BATCH);
+	struct flush_run run = { .cnt = 0, .bytes = 0 };
+	bool success = true;
+
+	for(struct vma *vma = vma_first(spt, start); vma != NULL && vma->start < end;
+			vma = vma_first(spt, vma->end)){
+		if(vma->dirty == NULL){
+			continue;
+		}
+		size_t idx = start > vma->start ? (size_t) (start - vma->start) / PGSIZE : 0;
+		size_t last = end < vma->end ? (size_t) (end - vma->start) / PGSIZE
+			: bitmap_size(vma->dirty);
+		while((idx = bitmap_scan(vma->dirty, idx, 1, true)) != BITMAP_ERROR && idx < last){
+			void *upage = vma->start + idx * PGSIZE;
+			off_t bytes = vma_page_read_bytes(vma, upage);
+			bitmap_reset(vma->dirty, idx++);
+			void *kva = flush_page(spt, upage);
+			if(kva == NULL){
+				continue;
+			}
+			/* Bytes past the end of the file are not written. */
+			if(bytes == 0){
+				vm_unpin_frame(kva);
+				continue;
+			}
+			if(run.cnt > 0 && (run.vma != vma || run.cnt == FLUSH_BATCH
+						|| run.upage + run.cnt * PGSIZE != upage || run.bytes % PGSIZE != 0)){
+				success = flush_run_write(&run, buf) && success;
+			}
+			if(run.cnt == 0){
+				run.vma = vma;
+				run.upage = upage;
+			}
+			run.kvas[run.cnt++] = kva;
+			run.bytes += bytes;
+		}
+	}
+	if(run.cnt > 0){
+		success = flush_run_write(&run, buf) && success;
+	}
+	if(buf != NULL){
+		palloc_free_multiple(buf, FLUSH_BATCH);
+	}
+	return success;
+	/* Project 3 */
+}
+
+/* Write-protect the page at UPAGE again, and clear its dirty bit.
+ * Returns its kva, pinned, if it was dirty, or NULL. */
+static void *
+flush_page (struct supplemental_page_table *spt, void *upage) {
+	struct page *page = spt_find_page(spt, upage);
+	struct frame *frame = page != NULL ? vm_pin_page_frame(page) : NULL;
+	if(frame == NULL){
+		/* Not resident: eviction wrote it back already. */
+		return NULL;
+	}
+	lock_acquire(&frame_lock);
+	bool dirty = vm_frame_test_and_clear_dirty(frame);
+	pml4_set_writable(page->pml4, page->va, false);
+	lock_release(&frame_lock);
+	if(!dirty){
+		vm_unpin_frame(frame->kva);
+		return NULL;
+	}
+	return frame->kva;
+}
+
+/* Write RUN back, through BUF if it is not NULL, unpin its frames and
+ * empty it. Returns false if the write came up short. */
+static bool
+flush_run_write (struct flush_run *run, void *buf) {
+	struct file *file = run->vma->file;
+	off_t ofs = vma_page_ofs(run->vma, run->upage);
+	bool success = true;
+
+	if(run->cnt > 1 && buf != NULL){
+		for(size_t i = 0; i < run->cnt; i++){
+			memcpy(buf + i * PGSIZE, run->kvas[i], PGSIZE);
+		}
+		success = file_write_at(file, buf, run->bytes, ofs) == run->bytes;
+	}
+	else{
+		for(size_t i = 0; i < run->cnt; i++){
+			off_t bytes = i + 1 < run->cnt ? PGSIZE : run->bytes - (off_t) i * PGSIZE;
+			success = file_write_at(file, run->kvas[i], bytes, ofs + i * PGSIZE) == bytes
+				&& success;
+		}
+	}
+	for(size_t i = 0; i < run->cnt; i++){
+		vm_unpin_frame(run->kvas[i]);
+	}
+	run->cnt = 0;
+	run->bytes = 0;
+	return success;
+}
+
+/* Do the msync: write back the dirty pages of the mmaps in
+ * [ADDR, ADDR + LENGTH), right away with MS_SYNC, or through the
+ * writeback daemon with MS_ASYNC. Returns false if a page of the range
+ * is not mapped, or a write failed. */
+bool
+do_msync (void *addr, size_t length, int flags) {
+	/* Project 3 */
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	void *end = addr + ROUND_UP(length, PGSIZE);
+	void *va = addr;
+
+	lock_acquire(&spt->lock);
+	for(struct vma *vma = vma_first(spt, va); vma != NULL && vma->start <= va && va < end;
+			vma = vma_first(spt, va)){
+		va = vma->end;
+	}
+	lock_release(&spt->lock);
+	if(va < end){
+		return false;
+	}
+	if(flags == MS_ASYNC && vm_writeback_flush_async(spt, addr, end)){
+		return true;
+	}
+	lock_acquire(&spt->lock);
+	bool success = file_backed_flush(spt, addr, end);
+	lock_release(&spt->lock);
+	return success;
+	/* Project 3 */
+}
+
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
@@ -80,37 +286,24 @@ void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
 	/* Project 3 */
-	file_seek(file, offset);
-	size_t read_bytes = length > file_length(file) ? file_length(file) : length;
-	size_t zero_bytes = PGSIZE - read_bytes % PGSIZE;
-	void *upage = addr;
-	int64_t mmap_id = timer_ticks();
-	while (read_bytes > 0 || zero_bytes > 0) {
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		/* Project 3 */
-		struct load_info * info = malloc(sizeof(struct load_info));
-		info->file = file_reopen(file);
-		info->ofs = offset;
-		info->page_read_bytes = page_read_bytes;
-		info->page_zero_bytes = page_zero_bytes;
-		info->mmap_id = mmap_id;
-		void *aux = info;
-		/* Project 3 */
-		if (!vm_alloc_page_with_initializer (VM_FILE, upage,
-					writable, lazy_load_segment, aux)){
-			free(aux);
-			return NULL;
-		}
-		/* Advance. */
-		read_bytes -= page_read_bytes;
-		zero_bytes -= page_zero_bytes;
-		upage += PGSIZE;
-		offset += page_read_bytes;
+	/* The pages are created by the fault handler, from the area. Bytes
+	 * past the end of the file read as zeros. A shared mapping holds its
+	 * last page up to the end of the file, as every other mapping of that
+	 * page does, so that they can all share one frame. */
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	off_t file_len = file_length(file);
+	size_t read_bytes = offset >= file_len ? 0 : (size_t)(file_len - offset);
+	size_t map_bytes = (writable & MAP_SHARED) != 0 ? ROUND_UP(length, PGSIZE) : length;
+	if(read_bytes > map_bytes){
+		read_bytes = map_bytes;
+	}
+	lock_acquire(&spt->lock);
+	struct vma *vma = vma_map(spt, addr, length, VM_FILE, writable & 1, file, offset, read_bytes);
+	if(vma != NULL){
+		vma->shared = (writable & MAP_SHARED) != 0;
 	}
-	return addr;
+	lock_release(&spt->lock);
+	return vma != NULL ? addr : NULL;
 	/* Project 3 */
 }
 
@@ -118,21 +311,26 @@ do_mmap (void *addr, size_t length, int writable,
 void
 do_munmap (void *addr) {
 	/* Project 3 */
-	struct page* page = spt_find_page(&thread_current()->spt, addr);
-	int64_t mmap_id = page->mmap_id;
-	if(mmap_id == 0){
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	lock_acquire(&spt->lock);
+	struct vma *vma = vma_find(spt, addr);
+	/* Only mmaps: not the stack, nor a segment of the executable. */
+	if(vma == NULL || vma->start != addr || VM_TYPE(vma->type) != VM_FILE || vma->exec
+			|| !vm_huge_split(spt, vma->start, vma->end)){
+		lock_release(&spt->lock);
 		return;
 	}
-	struct file* file = page->file.file;
-	while(((page = spt_find_page(&thread_current()->spt, addr)) != NULL) && (page->mmap_id == mmap_id)){
-		if(pml4_is_dirty(thread_current()->pml4, page->va)){
-			file_write_at(page->file.file, page->frame->kva, page->file.page_read_bytes, page->file.ofs);
+	/* Write back the dirty set in runs, spt_remove_page then finds the
+	 * pages clean. */
+	file_backed_flush(spt, vma->start, vma->end);
+	for(; addr < vma->end; addr += PGSIZE){
+		/* Pages never touched have no struct page. */
+		struct page* page = spt_find_page(spt, addr);
+		if(page != NULL){
+			spt_remove_page(spt, page);
 		}
-		pml4_clear_page(thread_current()->pml4, page->va);
-		hash_delete(&thread_current()->spt.spt_hash_table, &page->spt_elem);
-		file_close(page->file.file);
-		destroy(page);
-		addr += PGSIZE;
 	}
+	vma_unmap(spt, vma);
+	lock_release(&spt->lock);
 	/* Project 3 */
 }
@@ -0,0 +1,268 @@
+/* swap.c: Swap slot allocator.
+ *
+ * Free slots are kept as extents, runs of adjacent free slots, indexed
+ * two ways. The first and the last slot of an extent are tagged with it,
+ * so a freed slot merges with its free neighbours in constant time. Each
+ * extent is also on the list of its size class, so allocation finds a
+ * long enough run without scanning the whole disk.
+ *
+ * Allocation carves slots from the front of an extent. It first tries
+ * the hint, then a next-fit cursor left right after the previous
+ * allocation, so pages swapped out one after another land on adjacent
+ * slots, and only then searches the size class lists. */
+
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <list.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Extents of length in [2^c, 2^(c+1)) are on list c, the last list
+ * takes every longer one. */
+#define SIZE_CLASS_CNT 12
+
+/* A run of free slots. */
+struct swap_extent {
+	size_t start;			/* First slot */
+	size_t len;				/* Number of slots */
+	struct list_elem elem;	/* Element for its size class list */
+};
+
+static struct lock swap_lock;
+static size_t slot_cnt;
+static struct bitmap *used_map;			/* Slots allocated. */
+static int *refs;						/* Pages sharing each slot. */
+static struct swap_extent **tags;		/* Extent of each free boundary slot. */
+static struct list classes[SIZE_CLASS_CNT];
+static size_t cursor;					/* Next-fit cursor. */
+
+/* Statistics. */
+static size_t free_cnt;			/* Number of free slots. */
+static size_t extent_cnt;		/* Number of free extents. */
+static long long alloc_cnt;		/* Number of allocations. */
+static long long hint_cnt;		/* Allocations placed at the hint. */
+static long long cursor_cnt;	/* Allocations placed at the cursor. */
+static long long fail_cnt;		/* Allocations failed. */
+static long long search_cnt;	/* Extents looked at by searches. */
+static long long max_search;	/* Longest search. */
+
+static size_t size_class (size_t len);
+static void extent_insert (struct swap_extent *e);
+static void extent_remove (struct swap_extent *e);
+static struct swap_extent *extent_at (size_t idx, size_t cnt);
+static struct swap_extent *extent_search (size_t cnt);
+static void slot_free (size_t idx);
+
+/* Set up CNT free slots. */
+void
+swap_init (size_t cnt) {
+	lock_init (&swap_lock);
+	for (int c = 0; c < SIZE_CLASS_CNT; c++)
+		list_init (&classes[c]);
+	slot_cnt = cnt;
+	used_map = bitmap_create (slot_cnt);
+	refs = calloc (slot_cnt, sizeof *refs);
+	tags = calloc (slot_cnt, sizeof *tags);
+	if (used_map == NULL || refs == NULL || tags == NULL)
+		PANIC ("swap_init: cannot allocate swap table");
+	if (slot_cnt == 0)
+		return;
+
+	struct swap_extent *e = malloc (sizeof *e);
+	if (e == NULL)
+		PANIC ("swap_init: cannot allocate swap table");
+	e->start = 0;
+	e->len = slot_cnt;
+	extent_insert (e);
+	free_cnt = slot_cnt;
+}
+
+/* Allocate CNT adjacent slots, at HINT if it starts a long enough free
+ * run. HINT may be BITMAP_ERROR. Returns the first slot, or BITMAP_ERROR
+ * if there is no such run. */
+size_t
+swap_alloc (size_t cnt, size_t hint) {
+	ASSERT (cnt > 0);
+
+	lock_acquire (&swap_lock);
+	struct swap_extent *e;
+	if ((e = extent_at (hint, cnt)) != NULL)
+		hint_cnt++;
+	else if ((e = extent_at (cursor, cnt)) != NULL)
+		cursor_cnt++;
+	else
+		e = extent_search (cnt);
+
+	size_t idx = BITMAP_ERROR;
+	if (e != NULL) {
+		idx = e->start;
+		extent_remove (e);
+		e->start += cnt;
+		e->len -= cnt;
+		if (e->len > 0)
+			extent_insert (e);
+		else
+			free (e);
+		bitmap_set_multiple (used_map, idx, cnt, true);
+		free_cnt -= cnt;
+		cursor = (idx + cnt) % slot_cnt;
+		alloc_cnt++;
+	} else
+		fail_cnt++;
+	lock_release (&swap_lock);
+	return idx;
+}
+
+/* Add a page sharing slot IDX. */
+void
+swap_ref (size_t idx) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (used_map, idx));
+	refs[idx]++;
+	lock_release (&swap_lock);
+}
+
+/* Returns the number of pages sharing slot IDX. */
+int
+swap_ref_cnt (size_t idx) {
+	int cnt;
+
+	lock_acquire (&swap_lock);
+	cnt = refs[idx];
+	lock_release (&swap_lock);
+	return cnt;
+}
+
+/* Drop a page sharing slot IDX, freeing it with the last one. */
+void
+swap_unref (size_t idx) {
+	lock_acquire (&swap_lock);
+	ASSERT (refs[idx] > 0);
+	if (--refs[idx] == 0)
+		slot_free (idx);
+	lock_release (&swap_lock);
+}
+
+/* Prints swap statistics. Fragmentation is the share of free slots
+ * outside of the largest free extent. */
+void
+swap_print_stats (void) {
+	size_t largest = 0;
+
+	lock_acquire (&swap_lock);
+	for (int c = SIZE_CLASS_CNT - 1; c >= 0 && largest == 0; c--)
+		for (struct list_elem *e = list_begin (&classes[c]);
+				e != list_end (&classes[c]); e = list_next (e)) {
+			struct swap_extent *extent = list_entry (e, struct swap_extent, elem);
+			if (extent->len > largest)
+				largest = extent->len;
+		}
+	printf ("Swap: %zu of %zu slots free in %zu extents, largest %zu, "
+			"%zu%% fragmented\n", free_cnt, slot_cnt, extent_cnt, largest,
+			free_cnt > 0 ? (free_cnt - largest) * 100 / free_cnt : 0);
+	printf ("Swap: %lld allocations (%lld at hint, %lld at cursor), "
+			"%lld failed, %lld extents searched, longest search %lld\n",
+			alloc_cnt, hint_cnt, cursor_cnt, fail_cnt, search_cnt, max_search);
+	lock_release (&swap_lock);
+}
+
+/* Returns the size class of an extent of LEN slots. */
+static size_t
+size_class (size_t len) {
+	size_t c = 0;
+	while ((len >>= 1) != 0 && c < SIZE_CLASS_CNT - 1)
+		c++;
+	return c;
+}
+
+/* Make E a free extent: tag its boundaries and put it on its list. */
+static void
+extent_insert (struct swap_extent *e) {
+	tags[e->start] = e;
+	tags[e->start + e->len - 1] = e;
+	list_push_front (&classes[size_class (e->len)], &e->elem);
+	extent_cnt++;
+}
+
+/* Undo extent_insert. */
+static void
+extent_remove (struct swap_extent *e) {
+	tags[e->start] = NULL;
+	tags[e->start + e->len - 1] = NULL;
+	list_remove (&e->elem);
+	extent_cnt--;
+}
+
+/* Returns the free extent starting at IDX if it is at least CNT slots
+ * long, or NULL. */
+static struct swap_extent *
+extent_at (size_t idx, size_t cnt) {
+	if (idx >= slot_cnt || tags[idx] == NULL)
+		return NULL;
+	struct swap_extent *e = tags[idx];
+	return e->start == idx && e->len >= cnt ? e : NULL;
+}
+
+/* Returns a free extent at least CNT slots long, or NULL. Every extent
+ * in a class above CNT's fits, so only CNT's own class may need a walk. */
+static struct swap_extent *
+extent_search (size_t cnt) {
+	struct swap_extent *found = NULL;
+	long long steps = 0;
+
+	for (size_t c = size_class (cnt); c < SIZE_CLASS_CNT && found == NULL; c++)
+		for (struct list_elem *e = list_begin (&classes[c]);
+				e != list_end (&classes[c]); e = list_next (e)) {
+			struct swap_extent *extent = list_entry (e, struct swap_extent, elem);
+			steps++;
+			if (extent->len >= cnt) {
+				found = extent;
+				break;
+			}
+		}
+	search_cnt += steps;
+	if (steps > max_search)
+		max_search = steps;
+	return found;
+}
+
+/* Return slot IDX to the free extents, merged with its neighbours. */
+static void
+slot_free (size_t idx) {
+	struct swap_extent *left = NULL, *right = NULL, *e;
+
+	bitmap_reset (used_map, idx);
+	free_cnt++;
+	if (idx > 0 && tags[idx - 1] != NULL) {
+		left = tags[idx - 1];
+		extent_remove (left);
+	}
+	if (idx + 1 < slot_cnt && tags[idx + 1] != NULL) {
+		right = tags[idx + 1];
+		extent_remove (right);
+	}
+
+	if (left != NULL) {
+		e = left;
+		e->len++;
+	} else if (right != NULL) {
+		e = right;
+		e->start--;
+		e->len++;
+		right = NULL;
+	} else if ((e = malloc (sizeof *e)) != NULL) {
+		e->start = idx;
+		e->len = 1;
+	} else {
+		/* Out of memory: leak the slot. */
+		bitmap_mark (used_map, idx);
+		free_cnt--;
+		return;
+	}
+	if (right != NULL) {
+		e->len += right->len;
+		free (right);
+	}
+	extent_insert (e);
+}
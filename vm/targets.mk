@@ -1,5 +1,11 @@
 vm_SRC = vm/vm.c          # Main api proxy
 vm_SRC += vm/uninit.c     # Uninitialized page
 vm_SRC += vm/anon.c       # Anonymous page
+vm_SRC += vm/swap.c       # Swap slot allocator
 vm_SRC += vm/file.c       # File mapped page
+vm_SRC += vm/vma.c        # Virtual memory areas
+vm_SRC += vm/text.c       # Shared executable pages
+vm_SRC += vm/trace.c      # Latency tracepoints
 vm_SRC += vm/inspect.c    # Testing utility
+vm_SRC += vm/evict.c      # Page replacement policies
+vm_SRC += vm/writeback.c  # Background writeback
@@ -0,0 +1,133 @@
+/* text.c: Shared pages of read-only executable segments and shared
+ * file mappings.
+ *
+ * Every process running a binary used to read and keep its own copy of
+ * its code. The first process to load a page of a read-only segment now
+ * enters its frame here, and the others map that frame instead of
+ * loading the page again, as fork shares frames.
+ *
+ * Mappings made with MAP_SHARED go through the same index, so every
+ * process mapping a page of a file maps one frame, writable, and sees the
+ * writes of the others. The frame is written back once, whichever of
+ * them dirtied it. Entries of the two kinds never match each other: a
+ * shared mapping must not write to the code of a running binary. A page
+ * of a shared mapping holds the file up to its end whatever the length
+ * of the mapping, so its entries match on inode and offset alone.
+ *
+ * An entry lives as long as its frame holds the page: it is dropped when
+ * the frame is evicted or its last mapping goes away. The inode stays
+ * open meanwhile, since each mapper's segment holds it open. */
+
+#include "vm/text.h"
+#include <hash.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "vm/vm.h"
+
+struct text_page {
+	struct inode *inode;
+	off_t ofs;
+	size_t read_bytes;		/* The rest of the page is zeroed */
+	bool shared;			/* Of a shared mapping, or else of a binary */
+	void *kva;
+	struct hash_elem elem;
+};
+
+static struct hash text_pages;
+
+/* Statistics. */
+static long long hit_cnt;		/* Pages mapped from the cache. */
+static long long miss_cnt;		/* Lookups that found nothing. */
+
+static uint64_t text_hash (const struct hash_elem *e, void *aux);
+static bool text_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux);
+
+void
+vm_text_init (void) {
+	hash_init (&text_pages, text_hash, text_less, NULL);
+}
+
+/* Returns the kva holding the page at OFS in INODE with *READ_BYTES
+ * bytes of the file, for a shared mapping if SHARED, or NULL. For a
+ * shared mapping, *READ_BYTES is set to the bytes of the page found,
+ * which the file may have grown past since it was read. */
+void *
+vm_text_lookup (struct inode *inode, off_t ofs, size_t *read_bytes,
+		bool shared) {
+	struct text_page key = { .inode = inode, .ofs = ofs,
+		.read_bytes = *read_bytes, .shared = shared };
+	struct hash_elem *e = hash_find (&text_pages, &key.elem);
+	if (e == NULL) {
+		miss_cnt++;
+		return NULL;
+	}
+	hit_cnt++;
+	struct text_page *tp = hash_entry (e, struct text_page, elem);
+	*read_bytes = tp->read_bytes;
+	return tp->kva;
+}
+
+/* Record that KVA holds the page at OFS in INODE with READ_BYTES bytes
+ * of the file, for a shared mapping if SHARED, unless another frame does
+ * already. */
+void
+vm_text_insert (struct inode *inode, off_t ofs, size_t read_bytes,
+		bool shared, void *kva) {
+	struct phys_frame *pf = vm_phys_frame (kva);
+	if (pf->text != NULL)
+		return;
+	struct text_page *tp = malloc (sizeof *tp);
+	if (tp == NULL)
+		return;
+	tp->inode = inode;
+	tp->ofs = ofs;
+	tp->read_bytes = read_bytes;
+	tp->shared = shared;
+	tp->kva = kva;
+	if (hash_insert (&text_pages, &tp->elem) != NULL) {
+		free (tp);
+		return;
+	}
+	pf->text = tp;
+}
+
+/* Forget KVA, which is about to hold something else. */
+void
+vm_text_remove (void *kva) {
+	struct phys_frame *pf = vm_phys_frame (kva);
+	if (pf->text == NULL)
+		return;
+	hash_delete (&text_pages, &pf->text->elem);
+	free (pf->text);
+	pf->text = NULL;
+}
+
+/* Prints text cache statistics. */
+void
+vm_text_print_stats (void) {
+	printf ("Text cache: %zu pages, %lld hits, %lld misses\n",
+			hash_size (&text_pages), hit_cnt, miss_cnt);
+}
+
+static uint64_t
+text_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct text_page *tp = hash_entry (e, struct text_page, elem);
+	return hash_bytes (&tp->inode, sizeof tp->inode) ^ hash_int (tp->ofs);
+}
+
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct text_page *a = hash_entry (a_, struct text_page, elem);
+	const struct text_page *b = hash_entry (b_, struct text_page, elem);
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	if (a->shared != b->shared)
+		return a->shared < b->shared;
+	if (a->shared)
+		return false;
+	return a->read_bytes < b->read_bytes;
+}
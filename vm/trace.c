@@ -0,0 +1,127 @@
+/* trace.c: Latency tracepoints of the VM.
+ *
+ * Each traced event takes a TSC timestamp as it begins, and records the
+ * cycles it took as it ends: in a ring of the latest events, and in a
+ * log2 histogram of its class. Recording only disables interrupts for a
+ * few stores, so it is safe anywhere, even with the VM locks held, and
+ * never waits. There is a single CPU, so the ring is its per-CPU ring.
+ *
+ * vm_trace_print_stats dumps the histograms and the latest events at
+ * shutdown, to tell whether time goes to eviction, the disk or COW. */
+
+#include "vm/trace.h"
+#include <stdio.h>
+#include "threads/interrupt.h"
+
+/* Number of latest events kept, and of those printed. */
+#define TRACE_RING_SIZE 256
+#define TRACE_DUMP_CNT 16
+
+/* Number of log2 buckets: enough for any 64-bit cycle count. */
+#define TRACE_BUCKET_CNT 64
+
+struct trace_record {
+	enum vm_trace_event event;
+	const void *va;			/* Faulting page, or NULL */
+	uint64_t start;			/* TSC at the start */
+	uint64_t cycles;		/* Cycles taken */
+};
+
+bool vm_trace_enabled;
+
+static struct trace_record ring[TRACE_RING_SIZE];
+static uint64_t ring_cnt;		/* Events ever recorded. */
+
+static uint64_t hist[TRACE_EVENT_CNT][TRACE_BUCKET_CNT];
+static uint64_t total_cycles[TRACE_EVENT_CNT];
+static uint64_t max_cycles[TRACE_EVENT_CNT];
+
+static const char *event_names[TRACE_EVENT_CNT] = {
+	[TRACE_FAULT_STACK] = "fault/stack",
+	[TRACE_FAULT_LAZY] = "fault/lazy",
+	[TRACE_FAULT_ZERO] = "fault/zero",
+	[TRACE_FAULT_HUGE] = "fault/huge",
+	[TRACE_FAULT_TEXT] = "fault/text",
+	[TRACE_FAULT_SWAP] = "fault/swap",
+	[TRACE_FAULT_FILE] = "fault/file",
+	[TRACE_FAULT_COW] = "fault/cow",
+	[TRACE_FAULT_WAIT] = "fault/wait",
+	[TRACE_EVICT] = "evict",
+	[TRACE_SWAP_IN] = "swap-in",
+	[TRACE_SWAP_OUT] = "swap-out",
+};
+
+static uint64_t rdtsc (void);
+static int log2_bucket (uint64_t cycles);
+
+/* Returns the timestamp to pass to vm_trace_end, or 0 if tracing is
+ * off. */
+uint64_t
+vm_trace_begin (void) {
+	return vm_trace_enabled ? rdtsc () : 0;
+}
+
+/* Record EVENT, on VA, which began at START. */
+void
+vm_trace_end (enum vm_trace_event event, uint64_t start, const void *va) {
+	ASSERT (event < TRACE_EVENT_CNT);
+	if (!vm_trace_enabled || start == 0)
+		return;
+
+	uint64_t cycles = rdtsc () - start;
+	enum intr_level old_level = intr_disable ();
+	struct trace_record *r = &ring[ring_cnt++ % TRACE_RING_SIZE];
+	r->event = event;
+	r->va = va;
+	r->start = start;
+	r->cycles = cycles;
+	hist[event][log2_bucket (cycles)]++;
+	total_cycles[event] += cycles;
+	if (cycles > max_cycles[event])
+		max_cycles[event] = cycles;
+	intr_set_level (old_level);
+}
+
+/* Prints a latency histogram of each traced event, in cycles, and the
+ * latest events. */
+void
+vm_trace_print_stats (void) {
+	if (!vm_trace_enabled)
+		return;
+
+	for (int e = 0; e < TRACE_EVENT_CNT; e++) {
+		uint64_t cnt = 0;
+		for (int b = 0; b < TRACE_BUCKET_CNT; b++)
+			cnt += hist[e][b];
+		if (cnt == 0)
+			continue;
+		printf ("Trace: %s: %llu events, %llu cycles average, %llu max\n",
+				event_names[e], cnt, total_cycles[e] / cnt, max_cycles[e]);
+		for (int b = 0; b < TRACE_BUCKET_CNT; b++)
+			if (hist[e][b] > 0)
+				printf ("Trace:   < 2^%-2d cycles: %llu\n", b + 1, hist[e][b]);
+	}
+
+	uint64_t first = ring_cnt > TRACE_DUMP_CNT ? ring_cnt - TRACE_DUMP_CNT : 0;
+	for (uint64_t i = first; i < ring_cnt; i++) {
+		struct trace_record *r = &ring[i % TRACE_RING_SIZE];
+		printf ("Trace: #%llu %s va %p at %llu, %llu cycles\n",
+				i, event_names[r->event], r->va, r->start, r->cycles);
+	}
+}
+
+static uint64_t
+rdtsc (void) {
+	uint32_t lo, hi;
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
+/* Returns the index of the highest bit set in CYCLES, 0 for 0. */
+static int
+log2_bucket (uint64_t cycles) {
+	int b = 0;
+	while (cycles >>= 1)
+		b++;
+	return b;
+}
@@ -62,10 +62,10 @@ uninit_initialize (struct page *page, void *kva) {
  * PAGE will be freed by the caller. */
 static void
 uninit_destroy (struct page *page) {
-	struct uninit_page *uninit = &page->uninit;
+	struct uninit_page *uninit UNUSED = &page->uninit;
 	/* TODO: Fill this function.
 	 * TODO: If you don't have anything to do, just return. */
 	/* Project 3 */
-	free(uninit->aux);
+	/* AUX is the page's area, if any, which the page does not own. */
 	/* Project 3 */
 }
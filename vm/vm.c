@@ -3,13 +3,62 @@
 #include "threads/malloc.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "vm/evict.h"
+#include "vm/writeback.h"
+#include "vm/swap.h"
+#include "vm/vma.h"
+#include "vm/text.h"
+#include "vm/trace.h"
 
 /* Project 3 */
+#include <bitmap.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
 #include "threads/vaddr.h"
 #include "threads/mmu.h"
 #include "userprog/process.h"
+#include "filesys/file.h"
 
-struct list frame_table;
+/* Number of pages evicted at once when the user pool runs out. */
+#define EVICT_BATCH ANON_SWAP_BATCH
+
+/* Frame table. One entry per user pool page, indexed by its kva. */
+static struct phys_frame *phys_frames;
+struct lock frame_lock;
+struct lock evict_lock;
+static struct condition page_unbusy;	/* Signaled when busy bits clear. */
+
+/* -fault-around=N */
+size_t fault_around_pages = 16;
+static long long fault_around_cnt;		/* Pages mapped by fault-around. */
+
+/* Read-only page of zeros, mapped by zero-fill pages until written. */
+static void *zero_page;
+static long long zero_map_cnt;		/* Read faults served by the zero page. */
+static long long zero_cow_cnt;		/* Pages written after mapping it. */
+
+size_t stack_chunk_pages = 8;
+static long long stack_grow_cnt;	/* Faults that grew the stack. */
+static long long stack_eager_cnt;	/* Stack pages mapped ahead of use. */
+
+/* A run of LARGE_PGCNT pages mapped by one large page. Its frames are
+ * contiguous from KVA, and stay pinned until it is split. */
+struct huge_map {
+	struct supplemental_page_table *spt;
+	uint64_t *pml4;
+	void *va;
+	void *kva;
+	struct list_elem elem;
+};
+bool huge_pages = true;
+static struct list huge_maps;		/* Under frame_lock, oldest first. */
+static long long huge_map_cnt;		/* Large pages mapped. */
+static long long huge_split_cnt;	/* Large pages split into 4 KiB ones. */
+
+bool vm_stats_on_exit;
+static long long fault_cnt;			/* Page faults handled. */
+static long long major_fault_cnt;	/* Those that read from disk. */
 
 /* Project 3 */
 
@@ -26,7 +75,25 @@ vm_init (void) {
 	/* DO NOT MODIFY UPPER LINES. */
 	/* Project 3 */
 	/* TODO: Your code goes here. */
-	list_init(&frame_table);
+	size_t pf_cnt = palloc_user_page_cnt();
+	phys_frames = calloc(pf_cnt, sizeof(struct phys_frame));
+	if(phys_frames == NULL){
+		PANIC("vm_init: cannot allocate phys_frames");
+	}
+	for(size_t i = 0; i < pf_cnt; i++){
+		list_init(&phys_frames[i].rmap);
+	}
+	lock_init(&frame_lock);
+	lock_init(&evict_lock);
+	cond_init(&page_unbusy);
+	list_init(&huge_maps);
+	vm_evict_init();
+	vm_writeback_init();
+	vm_text_init();
+	zero_page = palloc_get_page(PAL_ZERO);
+	if(zero_page == NULL){
+		PANIC("vm_init: cannot allocate the zero page");
+	}
 	/* Project 3 */
 }
 
@@ -47,7 +114,42 @@ page_get_type (struct page *page) {
 /* Helpers */
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
+static bool vm_map_frame (struct page *page, struct frame *frame);
+static bool vm_load_frame (struct page *page, struct frame *frame);
+static bool vm_huge_fault (struct supplemental_page_table *spt,
+		struct page *page, bool *loaded);
+static bool vm_huge_split_map (struct huge_map *map);
+static struct frame *vm_new_frame (void *kva);
+static bool vm_fault_is_major (struct supplemental_page_table *spt,
+		struct page *page);
+static void vm_count_major_fault (void);
+static void vm_reclaim_behind (struct supplemental_page_table *spt, void *va);
+static bool vm_willneed (struct supplemental_page_table *spt, void *start,
+		void *end);
+static void vm_fault_around (struct supplemental_page_table *spt, void *va);
+static bool vm_stack_premap (struct supplemental_page_table *spt, void *va);
+static struct vma *vm_text_vma (struct supplemental_page_table *spt,
+		struct page *page);
+static bool vm_text_share (struct supplemental_page_table *spt,
+		struct page *page);
+static void vm_text_offer (struct supplemental_page_table *spt,
+		struct page *page);
 static struct frame *vm_evict_frame (void);
+static void vm_frame_detach (struct frame *frame);
+static void vm_frame_remap_all (struct frame *frame);
+static void vm_page_wait (struct page *page);
+static bool spt_copy_page (struct supplemental_page_table *dst, struct page *page);
+static bool vm_handle_fault (struct supplemental_page_table *spt,
+		struct intr_frame *f, void *addr, bool user, bool write,
+		bool not_present, enum vm_trace_event *event);
+static bool vm_is_zero_fill (struct supplemental_page_table *spt,
+		struct page *page);
+static bool vm_remap_page (struct page *page, void *kva, bool writable);
+static bool vm_page_writable (struct page *page);
+static bool vm_page_shared (struct page *page);
+static bool vm_cow_swap_connect (struct page *dst_page, struct page *src_page);
+static struct page *spt_find_or_create (struct supplemental_page_table *spt,
+		void *va);
 
 // /* Create the pending page object with initializer. If you want to create a
 //  * page, do not create it directly and make it through this function or
@@ -113,10 +215,48 @@ spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
 	/* Project 3 */
 }
 
+/* Find VA from spt, creating its page from the area holding VA if it has
+ * not been touched yet. Return NULL if VA is not mapped. */
+struct page *
+spt_get_page (struct supplemental_page_table *spt, void *va) {
+	/* Project 3 */
+	lock_acquire(&spt->lock);
+	struct page *page = spt_find_or_create(spt, va);
+	lock_release(&spt->lock);
+	return page;
+	/* Project 3 */
+}
+
+/* spt_get_page with SPT locked. */
+static struct page *
+spt_find_or_create (struct supplemental_page_table *spt, void *va) {
+	struct page *page = spt_find_page(spt, va);
+	if(page != NULL){
+		return page;
+	}
+	struct vma *vma = vma_find(spt, va);
+	if(vma == NULL || !vm_alloc_page_with_initializer(vma->type, pg_round_down(va),
+				vma->writable, vma->file != NULL ? lazy_load_segment : NULL, vma)){
+		return NULL;
+	}
+	return spt_find_page(spt, va);
+}
+
+/* Remove PAGE from SPT and free it, writing it back first if it is a
+ * dirty file-backed page. Its area, if any is left, creates it again on
+ * the next touch. SPT must be locked. */
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
 	/* Project 3 */
-
+	struct frame *frame = vm_pin_page_frame(page);
+	if(frame != NULL && page_get_type(page) == VM_FILE && pml4_is_dirty(page->pml4, page->va)){
+		file_write_at(page->file.file, frame->kva, page->file.page_read_bytes, page->file.ofs);
+	}
+	pml4_clear_page(page->pml4, page->va);
+	if(frame != NULL){
+		vm_free_frame(frame);
+	}
+	hash_delete(&spt->spt_hash_table, &page->spt_elem);
 	vm_dealloc_page (page);
 	/* Project 3 */
 }
@@ -124,71 +264,193 @@ spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
 /* Get the struct frame, that will be evicted. */
 static struct frame *
 vm_get_victim (void) {
-	
 	/* TODO: The policy for eviction is up to you. */
 	/* Project 3 */
-	static int i = 1;
-	struct frame *victim = NULL;
-	struct thread *cur = thread_current();
-	if(i > 0){
-		for(struct list_elem * e = list_begin(&frame_table); e != list_end(&frame_table); e = list_next(e)){
-			victim = list_entry(e, struct frame, ft_elem);
-			if(!pml4_is_accessed(cur->pml4, victim->page->va)){
-				pml4_set_accessed(cur->pml4, victim->page->va, true);
-				i *= -1;
-				return victim;
-			}
+	return vm_evict_get_victim();
+	/* Project 3 */
+}
+
+/* Evict up to EVICT_BATCH pages and return the frame of one of them,
+ * pinned. Anonymous victims are swapped out together, so adjacent swap
+ * slots go out in one disk command, and the kvas of the other victims go
+ * back to the user pool for the next faults.
+ * The victims are unmapped and made busy under the frame lock, written
+ * out without it, then handed back under it again, so faults that find
+ * a free frame go on during the writes. evict_lock must be held.
+ * Return NULL on error.*/
+static struct frame *
+vm_evict_frame (void) {
+	/* TODO: swap out the victim and return the evicted frame. */
+	/* Project 3 */
+	struct frame *victims[EVICT_BATCH];
+	struct page *anon_pages[EVICT_BATCH];
+	bool evicted[EVICT_BATCH];
+	bool anon_evicted[EVICT_BATCH];
+	size_t victim_cnt = 0, anon_cnt = 0;
+	uint64_t start = vm_trace_begin();
+
+	lock_acquire(&frame_lock);
+	while(victim_cnt < EVICT_BATCH){
+		struct frame *victim = vm_get_victim ();
+		if(victim == NULL){
+			break;
 		}
+#ifdef EFILESYS
+		/* Writing a file page back goes through the page cache, which
+		 * waits for its busy pages: keep them out of such a batch. */
+		if(victim_cnt > 0 && (page_get_type(victim->page) == VM_PAGE_CACHE)
+				!= (page_get_type(victims[0]->page) == VM_PAGE_CACHE)){
+			break;
+		}
+#endif
+		vm_frame_set_busy(victim, true);
+		vm_text_remove(victim->kva);
+		vm_phys_frame(victim->kva)->dirty = vm_frame_unmap_all(victim);
+		victims[victim_cnt++] = victim;
 	}
-	else{
-		for(struct list_elem * e = list_end(&frame_table); e != list_begin(&frame_table); e = list_prev(e)){
-			victim = list_entry(e, struct frame, ft_elem);
-			if(!pml4_is_accessed(cur->pml4, victim->page->va)){
-				pml4_set_accessed(cur->pml4, victim->page->va, true);
-				i *= -1;
-				return victim;
-			}
+	lock_release(&frame_lock);
+
+	for(size_t i = 0; i < victim_cnt; i++){
+		struct page *page = victims[i]->page;
+		if(VM_TYPE(page->operations->type) == VM_ANON){
+			anon_pages[anon_cnt++] = page;
 		}
+		else{
+			evicted[i] = swap_out(page);
+		}
+	}
+	if(anon_cnt > 0){
+		anon_swap_out_multiple(anon_pages, anon_evicted, anon_cnt);
 	}
-	
-	for(struct list_elem * e = list_begin(&frame_table); e != list_end(&frame_table); e = list_next(e)){
-		victim = list_entry(e, struct frame, ft_elem);
-		pml4_set_accessed(cur->pml4, victim->page->va, false);
+
+	struct frame *frame = NULL;
+	lock_acquire(&frame_lock);
+	for(size_t i = 0, j = 0; i < victim_cnt; i++){
+		struct frame *victim = victims[i];
+		if(VM_TYPE(victim->page->operations->type) == VM_ANON){
+			evicted[i] = anon_evicted[j++];
+		}
+		vm_frame_set_busy(victim, false);
+		if(!evicted[i]){
+			vm_frame_remap_all(victim);
+			continue;
+		}
+		vm_frame_detach(victim);
+		if(frame == NULL){
+			struct phys_frame *pf = vm_phys_frame(victim->kva);
+			pf->pin_cnt++;
+			pf->referenced = true;
+			victim->page = NULL;
+			frame = victim;
+		}
+		else{
+			list_remove(&victim->rmap_elem);
+			palloc_free_page(victim->kva);
+			free(victim);
+		}
 	}
+	lock_release(&frame_lock);
+	vm_trace_end(TRACE_EVICT, start, NULL);
 	/* Project 3 */
-	return victim;
+	return frame;
 }
 
-/* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+/* After swap_out unmapped every sharer of FRAME's kva, keep only FRAME
+ * for reuse. The other sharers lose their frames. */
+static void
+vm_frame_detach (struct frame *frame) {
+	struct phys_frame *pf = vm_phys_frame(frame->kva);
+	while(list_size(&pf->rmap) > 1){
+		struct list_elem *e = list_front(&pf->rmap);
+		struct frame *sharer = list_entry(e, struct frame, rmap_elem);
+		if(sharer == frame){
+			sharer = list_entry(list_next(e), struct frame, rmap_elem);
+		}
+		sharer->page->frame = NULL;
+		list_remove(&sharer->rmap_elem);
+		free(sharer);
+	}
+	pf->cpy_cnt = 0;
+	frame->page->frame = NULL;
+}
+
+/* Map FRAME's kva back in every page sharing it after its eviction
+ * failed, with the dirty bit vm_frame_unmap_all took. */
+static void
+vm_frame_remap_all (struct frame *frame) {
+	struct phys_frame *pf = vm_phys_frame(frame->kva);
+	for(struct list_elem * e = list_begin(&pf->rmap); e != list_end(&pf->rmap); e = list_next(e)){
+		struct page *page = list_entry(e, struct frame, rmap_elem)->page;
+		if(page != NULL){
+			pml4_set_page(page->pml4, page->va, frame->kva,
+					vm_page_writable(page) && (pf->cpy_cnt == 0 || vm_page_shared(page)));
+			pml4_set_dirty(page->pml4, page->va, pf->dirty);
+		}
+	}
+}
+
+/* Get a free page of the user pool, pinned, or NULL if there is none.
+ * Unlike vm_get_frame, never evicts: for pages taken on a guess. */
+struct frame *
+vm_alloc_frame (void) {
+	void *kva = palloc_get_page(PAL_USER);
+	if(kva == NULL){
+		return NULL;
+	}
+	struct frame *frame = vm_new_frame(kva);
+	if(frame == NULL){
+		palloc_free_page(kva);
+	}
+	return frame;
+}
+
+/* Make a pinned frame for KVA, a page just taken from the user pool.
+ * Returns NULL on allocation failure. */
 static struct frame *
-vm_evict_frame (void) {
-	struct frame *victim = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
-	swap_out(victim->page);
-	return victim;
+vm_new_frame (void *kva) {
+	struct frame *frame = (struct frame *)calloc(sizeof (struct frame), 1);
+	if(frame == NULL){
+		return NULL;
+	}
+	frame->kva = kva;
+
+	struct phys_frame *pf = vm_phys_frame(kva);
+	lock_acquire(&frame_lock);
+	list_push_back(&pf->rmap, &frame->rmap_elem);
+	pf->referenced = true;
+	pf->pin_cnt++;
+	lock_release(&frame_lock);
+	return frame;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
  * and return it. This always return valid address. That is, if the user pool
  * memory is full, this function evicts the frame to get the available memory
- * space.*/
-static struct frame *
+ * space. The frame comes pinned, see vm_unpin_frame.*/
+struct frame *
 vm_get_frame (void) {
-	struct frame *frame = (struct frame *)calloc(sizeof (struct frame), 1);
 	/* TODO: Fill this function. */
 	/* Project 3 */
-	frame->kva = palloc_get_page(PAL_USER);
-	if(frame->kva == NULL){
-		free(frame);
-		frame = vm_evict_frame();
+	struct frame *frame = vm_alloc_frame();
+	if(frame == NULL){
+		vm_writeback_kick();
+		lock_acquire(&evict_lock);
+		/* Another evictor may have freed pages while we waited. */
+		frame = vm_alloc_frame();
+		if(frame == NULL){
+			/* Memory is tight: let the oldest large page be evicted a
+			 * page at a time. */
+			lock_acquire(&frame_lock);
+			if(!list_empty(&huge_maps)){
+				vm_huge_split_map(list_entry(list_front(&huge_maps), struct huge_map, elem));
+			}
+			lock_release(&frame_lock);
+			frame = vm_evict_frame();
+		}
+		lock_release(&evict_lock);
 		if(frame == NULL){
 			return NULL;
 		}
-		frame->page = NULL;
-	}
-	else{
-		list_push_back(&frame_table, &frame->ft_elem);
 	}
 	/* Project 3 */ 
 	ASSERT (frame != NULL);
@@ -196,16 +458,82 @@ vm_get_frame (void) {
 	return frame;
 }
 
-/* Growing the stack. */
-static void
-vm_stack_growth (void *addr) {
-	int pgnum = (thread_current()->stack_bottom - (uintptr_t)pg_round_down(addr)) / PGSIZE;
+/* Grow the stack down over ADDR, a fault below it. The stack grows by
+ * whole stack_chunk_pages aligned chunks, so a deep frame or a run of
+ * pushes takes one fault per chunk rather than one per page. The page of
+ * ADDR is claimed, and the rest of the new chunk is mapped up front from
+ * free frames while the writeback daemon would not have to reclaim them;
+ * pages left out are zero-filled on their own fault. Returns false if
+ * ADDR is not a stack access. SPT must be locked. */
+static bool
+vm_stack_growth (struct supplemental_page_table *spt, void *addr) {
+	void *top = (void *) USER_STACK;
+	void *limit = top - STACK_LIMIT;
+	if(addr >= top || addr < limit){
+		return false;
+	}
+	/* PUSH faults 8 bytes below rsp before moving it. */
+	if((uintptr_t) addr < thread_current()->ursp - 8){
+		return false;
+	}
+	struct vma *stack = vma_find(spt, top - 1);
+	if(stack == NULL || addr >= stack->start){
+		return false;
+	}
+
+	size_t chunk = stack_chunk_pages < 1 ? 1 : stack_chunk_pages > 16 ? 16 : stack_chunk_pages;
+	void *upage = pg_round_down(addr);
+	void *bottom = (void *) ((uintptr_t) upage / (chunk * PGSIZE) * (chunk * PGSIZE));
+	if(bottom < limit){
+		bottom = limit;
+	}
+	void *old_start = stack->start;
+	if(!vma_grow_down(spt, stack, bottom) && !vma_grow_down(spt, stack, upage)){
+		return false;
+	}
+
+	struct page *page = spt_find_or_create(spt, upage);
+	if(page == NULL || !vm_do_claim_page(page)){
+		return false;
+	}
+	stack_grow_cnt++;
+	/* Below ADDR first, where a growing stack goes next, then any pages
+	 * skipped between ADDR and the old bottom. */
+	for(void *va = upage; va > stack->start; ){
+		va -= PGSIZE;
+		if(!vm_stack_premap(spt, va)){
+			return true;
+		}
+	}
+	for(void *va = upage + PGSIZE; va < old_start; va += PGSIZE){
+		if(!vm_stack_premap(spt, va)){
+			break;
+		}
+	}
+	return true;
+}
 
-	for(int i = 1 ; i <= pgnum ; i++){
-		vm_alloc_page(VM_ANON | VM_MARKER_0, thread_current()->stack_bottom - PGSIZE*i, true);
-		vm_claim_page(thread_current()->stack_bottom + PGSIZE*i);
+/* Map stack page VA, unless it already is, with a free frame, as long as
+ * the writeback daemon would not have to reclaim it. Returns false once
+ * no more pages should be mapped. SPT must be locked. */
+static bool
+vm_stack_premap (struct supplemental_page_table *spt, void *va) {
+	if(spt_find_page(spt, va) != NULL){
+		return true;
+	}
+	if(palloc_user_free_cnt() <= writeback_low_pages){
+		return false;
+	}
+	struct page *page = spt_find_or_create(spt, va);
+	if(page == NULL){
+		return false;
+	}
+	struct frame *frame = vm_alloc_frame();
+	if(frame == NULL || !vm_map_frame(page, frame)){
+		return false;
 	}
-	thread_current()->stack_bottom = pg_round_down(addr);
+	stack_eager_cnt++;
+	return true;
 }
 
 /* Handle the fault on write_protected page */
@@ -225,32 +553,458 @@ vm_try_handle_fault (struct intr_frame *f, void *addr,
 	if(is_user_vaddr(addr) == false){
 		return false;
 	}
-	if(pml4_get_page(thread_current()->pml4, addr) == NULL){
-		if(spt_find_page(&thread_current()->spt, addr) == NULL){
-			if(addr >= USER_STACK){
-				return false;
-			}
-			if(user == true){
-				thread_current()->ursp = f->rsp;
-			}
-			if((USER_STACK - 0x100000 <= thread_current()->ursp - 8) && (thread_current()->ursp - 8 <= addr)){
-				vm_stack_growth(addr);
-				return true;
-			}
-			return false;
-		}
+	uint64_t start = vm_trace_begin();
+	enum vm_trace_event event = TRACE_FAULT_LAZY;
+	lock_acquire(&spt->lock);
+	bool success = vm_handle_fault(spt, f, addr, user, write, not_present, &event);
+	lock_release(&spt->lock);
+	if(success){
+		vm_trace_end(event, start, pg_round_down(addr));
+		thread_current()->vm_faults++;
+		fault_cnt++;
+	}
+	return success;
+	/* Project 3 */
+}
+
+/* vm_try_handle_fault with SPT locked. Sets *EVENT to the class of the
+ * fault, for tracing. */
+static bool
+vm_handle_fault (struct supplemental_page_table *spt, struct intr_frame *f,
+		void *addr, bool user, bool write, bool not_present,
+		enum vm_trace_event *event) {
+	if(user){
+		thread_current()->ursp = f->rsp;
+	}
+	struct page *page = spt_find_or_create(spt, addr);
+	if(page == NULL){
+		*event = TRACE_FAULT_STACK;
+		return not_present && vm_stack_growth(spt, addr);
+	}
+	if(write && page->writable && !file_backed_mark_dirty(spt, page->va)){
+		return false;
 	}
 
-	struct page *page = spt_find_page(spt, addr);
 	if(!not_present){
 		if(!page->writable){
 			return false;
 		}
+		*event = TRACE_FAULT_COW;
 		return vm_copy_on_write(page);
 	}
-	
-	/* Project 3 */
-	return vm_do_claim_page (page);
+
+	/* The page may be under eviction, or back from one that failed. */
+	lock_acquire(&frame_lock);
+	vm_page_wait(page);
+	bool resident = page->frame != NULL;
+	lock_release(&frame_lock);
+	if(resident){
+		*event = TRACE_FAULT_WAIT;
+		return true;
+	}
+	bool first_touch = VM_TYPE(page->operations->type) == VM_UNINIT;
+	bool major = vm_fault_is_major(spt, page);
+	bool loaded;
+	*event = first_touch ? TRACE_FAULT_LAZY
+		: page_get_type(page) == VM_FILE ? TRACE_FAULT_FILE : TRACE_FAULT_SWAP;
+	if(first_touch && vm_huge_fault(spt, page, &loaded)){
+		*event = TRACE_FAULT_HUGE;
+		if(loaded && major){
+			vm_count_major_fault();
+		}
+		return loaded;
+	}
+	/* Reading a page that would be zero-filled: map the zero page, the
+	 * first write gets a frame through vm_copy_on_write. */
+	if(!write && vm_is_zero_fill(spt, page)){
+		if(!pml4_set_page(page->pml4, page->va, zero_page, false)){
+			return false;
+		}
+		*event = TRACE_FAULT_ZERO;
+		zero_map_cnt++;
+		return true;
+	}
+	if(vm_text_share(spt, page)){
+		*event = TRACE_FAULT_TEXT;
+	}
+	else{
+		if(!vm_do_claim_page (page)){
+			return false;
+		}
+		if(major){
+			vm_count_major_fault();
+		}
+		vm_text_offer(spt, page);
+	}
+	if(first_touch){
+		vm_fault_around(spt, page->va);
+	}
+	vm_reclaim_behind(spt, page->va);
+	return true;
+}
+
+/* On the first touch of VA in an executable segment, also load the
+ * untouched pages around it that hold file contents. The window is the
+ * fault_around_pages aligned pages holding VA, read in one pass in
+ * address order. In an area advised MADV_SEQUENTIAL, it is the pages
+ * right after VA instead, and MADV_RANDOM turns it off. Only free
+ * frames are used, and only while the writeback daemon would not have
+ * to reclaim them, so that the guesses never cost an eviction. Their
+ * accessed bits stay clear, so unused ones are the first to go. Other
+ * mmaps and BSS pages stay strictly lazy, as the lazy-file and lazy-anon
+ * tests expect. SPT must be locked. */
+static void
+vm_fault_around (struct supplemental_page_table *spt, void *va) {
+	struct vma *vma = vma_find(spt, va);
+	if(fault_around_pages < 2 || vma == NULL || vma->file == NULL || vma->advice == MADV_RANDOM){
+		return;
+	}
+	uintptr_t window = fault_around_pages * PGSIZE;
+	void *start, *end;
+	if(vma->advice == MADV_SEQUENTIAL){
+		start = va + PGSIZE;
+		end = va + window;
+	}
+	else if(vma->exec){
+		start = (void *) ((uintptr_t) va / window * window);
+		end = start + window;
+	}
+	else{
+		return;
+	}
+	void *file_end = vma->start + ROUND_UP(vma->read_bytes, PGSIZE);
+	if(start < vma->start){
+		start = vma->start;
+	}
+	if(end > file_end){
+		end = file_end;
+	}
+	for(void *upage = start; upage < end; upage += PGSIZE){
+		if(upage == va || spt_find_page(spt, upage) != NULL){
+			continue;
+		}
+		if(!vm_alloc_page_with_initializer(vma->type, upage, vma->writable, lazy_load_segment, vma)){
+			break;
+		}
+		struct page *page = spt_find_page(spt, upage);
+		if(vm_text_share(spt, page)){
+			fault_around_cnt++;
+			continue;
+		}
+		if(palloc_user_free_cnt() <= writeback_low_pages){
+			break;
+		}
+		struct frame *frame = vm_alloc_frame();
+		if(frame == NULL){
+			break;
+		}
+		vm_phys_frame(frame->kva)->referenced = false;
+		if(!vm_map_frame(page, frame)){
+			break;
+		}
+		vm_text_offer(spt, page);
+		fault_around_cnt++;
+	}
+}
+
+/* In an area advised MADV_SEQUENTIAL, the access point has moved past
+ * the pages a window behind VA: make them the first to be evicted.
+ * SPT must be locked. */
+static void
+vm_reclaim_behind (struct supplemental_page_table *spt, void *va) {
+	struct vma *vma = vma_find(spt, va);
+	if(vma == NULL || vma->advice != MADV_SEQUENTIAL){
+		return;
+	}
+	size_t window = (fault_around_pages > 1 ? fault_around_pages : 1) * PGSIZE;
+	if((size_t) (va - vma->start) < window){
+		return;
+	}
+	void *end = va - window;
+	void *start = (size_t) (end - vma->start) < window ? vma->start : end - window;
+
+	lock_acquire(&frame_lock);
+	for(void *upage = start; upage < end; upage += PGSIZE){
+		struct page *page = spt_find_page(spt, upage);
+		if(page != NULL && page->frame != NULL && !page->busy){
+			vm_phys_frame(page->frame->kva)->referenced = false;
+			vm_frame_test_and_clear_accessed(page->frame);
+		}
+	}
+	lock_release(&frame_lock);
+}
+
+/* Read in the pages of [START, END) whose fault would read a disk, from
+ * free frames while the writeback daemon would not have to reclaim them.
+ * Returns false if no area overlaps the range. SPT must be locked. */
+static bool
+vm_willneed (struct supplemental_page_table *spt, void *start, void *end) {
+	bool found = false;
+	for(void *va = start; va < end; va += PGSIZE){
+		struct vma *vma = vma_find(spt, va);
+		if(vma == NULL){
+			continue;
+		}
+		found = true;
+		struct page *page = spt_find_page(spt, va);
+		if(page == NULL){
+			/* Leave pages that would be zero-filled untouched. */
+			if(vma->file == NULL || vma_page_read_bytes(vma, va) == 0){
+				continue;
+			}
+			page = spt_find_or_create(spt, va);
+			if(page == NULL){
+				break;
+			}
+		}
+		lock_acquire(&frame_lock);
+		vm_page_wait(page);
+		bool resident = page->frame != NULL;
+		lock_release(&frame_lock);
+		if(resident || !vm_fault_is_major(spt, page) || vm_text_share(spt, page)){
+			continue;
+		}
+		if(palloc_user_free_cnt() <= writeback_low_pages){
+			break;
+		}
+		struct frame *frame = vm_alloc_frame();
+		if(frame == NULL || !vm_map_frame(page, frame)){
+			break;
+		}
+		vm_text_offer(spt, page);
+	}
+	return found;
+}
+
+/* Apply ADVICE, one of MADV_*, to the pages of the current process in
+ * [ADDR, ADDR + LENGTH). Returns false if ADVICE is unknown, no area
+ * overlaps the range, or MADV_FREE would cover a file mapping. */
+bool
+vm_madvise (void *addr, size_t length, int advice) {
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	void *end = addr + ROUND_UP(length, PGSIZE);
+	bool success = false;
+
+	lock_acquire(&spt->lock);
+	switch(advice){
+		case MADV_NORMAL:
+		case MADV_RANDOM:
+		case MADV_SEQUENTIAL:
+			for(void *va = addr; va < end; ){
+				struct vma *vma = vma_find(spt, va);
+				if(vma == NULL){
+					va += PGSIZE;
+					continue;
+				}
+				vma->advice = advice;
+				success = true;
+				va = vma->end;
+			}
+			break;
+		case MADV_WILLNEED:
+			success = vm_willneed(spt, addr, end);
+			break;
+		case MADV_FREE:
+		case MADV_DONTNEED:
+			success = vma_overlaps(spt, addr, end);
+			for(void *va = addr; success && advice == MADV_FREE && va < end; ){
+				struct vma *vma = vma_find(spt, va);
+				if(vma == NULL){
+					va += PGSIZE;
+					continue;
+				}
+				success = VM_TYPE(vma->type) == VM_ANON;
+				va = vma->end;
+			}
+			if(!success || !vm_huge_split(spt, addr, end)){
+				success = false;
+				break;
+			}
+			for(void *va = addr; va < end; va += PGSIZE){
+				struct page *page = spt_find_page(spt, va);
+				if(page != NULL){
+					spt_remove_page(spt, page);
+				}
+			}
+			break;
+	}
+	lock_release(&spt->lock);
+	return success;
+}
+
+/* Returns true if PAGE has never been loaded, and would be filled with
+ * zeros: an anonymous page with no initializer, or one of its area past
+ * the bytes read from the file, as BSS. */
+static bool
+vm_is_zero_fill (struct supplemental_page_table *spt, struct page *page) {
+	if(VM_TYPE(page->operations->type) != VM_UNINIT || VM_TYPE(page->uninit.type) != VM_ANON){
+		return false;
+	}
+	if(page->uninit.init == NULL){
+		return true;
+	}
+	struct vma *vma = vma_find(spt, page->va);
+	return vma != NULL && vma_page_read_bytes(vma, page->va) == 0;
+}
+
+/* Returns PAGE's area if it is a read-only executable segment or a
+ * shared mapping, whose pages go through the text cache, or NULL. */
+static struct vma *
+vm_text_vma (struct supplemental_page_table *spt, struct page *page) {
+	struct vma *vma = vma_find(spt, page->va);
+	if(vma == NULL || vma->file == NULL || !(vma->shared || (vma->exec && !vma->writable))){
+		return NULL;
+	}
+	return vma;
+}
+
+/* Map PAGE, not resident, to the frame of another process that holds
+ * the same page of the same executable or shared mapping, if any.
+ * Returns true if it was mapped. SPT must be locked. */
+static bool
+vm_text_share (struct supplemental_page_table *spt, struct page *page) {
+	struct vma *vma = vm_text_vma(spt, page);
+	if(vma == NULL){
+		return false;
+	}
+	struct frame *frame = calloc(1, sizeof *frame);
+	if(frame == NULL){
+		return false;
+	}
+	size_t read_bytes = vma_page_read_bytes(vma, page->va);
+	lock_acquire(&frame_lock);
+	void *kva = vm_text_lookup(file_get_inode(vma->file), vma_page_ofs(vma, page->va),
+			&read_bytes, vma->shared);
+	if(kva == NULL){
+		lock_release(&frame_lock);
+		free(frame);
+		return false;
+	}
+	struct phys_frame *pf = vm_phys_frame(kva);
+	pf->pin_cnt++;
+	pf->referenced = true;
+	frame->kva = kva;
+	frame->page = page;
+	page->frame = frame;
+	list_push_back(&pf->rmap, &frame->rmap_elem);
+	vm_inc_cpy_cnt(kva, 1);
+	lock_release(&frame_lock);
+
+	/* The contents are there already: only turn PAGE into a file page. */
+	if(VM_TYPE(page->operations->type) == VM_UNINIT){
+		page->uninit.page_initializer(page, page->uninit.type, kva);
+		page->file.file = vma->file;
+		page->file.vma = vma;
+		page->file.ofs = vma_page_ofs(vma, page->va);
+	}
+	/* Written back as much as the page holds, which a shared mapping
+	 * takes from the page it maps. */
+	page->file.page_read_bytes = read_bytes;
+	page->file.page_zero_bytes = PGSIZE - read_bytes;
+	if(!pml4_set_page(page->pml4, page->va, kva, vma->shared && vm_page_writable(page))){
+		vm_free_frame(frame);
+		return false;
+	}
+	vm_unpin_frame(kva);
+	return true;
+}
+
+/* Enter the frame PAGE has just been loaded into in the text cache, if
+ * PAGE belongs to a read-only executable segment. SPT must be locked. */
+static void
+vm_text_offer (struct supplemental_page_table *spt, struct page *page) {
+	struct vma *vma = vm_text_vma(spt, page);
+	if(vma == NULL){
+		return;
+	}
+	lock_acquire(&frame_lock);
+	if(page->frame != NULL && !page->busy){
+		vm_text_insert(file_get_inode(vma->file), vma_page_ofs(vma, page->va),
+				vma_page_read_bytes(vma, page->va), vma->shared, page->frame->kva);
+	}
+	lock_release(&frame_lock);
+}
+
+/* Returns true if loading PAGE, not resident, reads from a disk: it is
+ * swapped out, file-backed, or first touched with bytes from its file.
+ * SPT must be locked. */
+static bool
+vm_fault_is_major (struct supplemental_page_table *spt, struct page *page) {
+	switch(VM_TYPE(page->operations->type)){
+		case VM_UNINIT:
+			{
+			struct vma *vma = vma_find(spt, page->va);
+			return vma != NULL && vma->file != NULL && vma_page_read_bytes(vma, page->va) > 0;
+			}
+		case VM_ANON:
+			return page->anon.idx != BITMAP_ERROR;
+		default:
+			return true;
+	}
+}
+
+static void
+vm_count_major_fault (void) {
+	thread_current()->vm_major_faults++;
+	major_fault_cnt++;
+}
+
+/* Fill STATS with the VM statistics of T, a process. The resident and
+ * swapped counts are taken from its pages as they are now. */
+void
+vm_thread_stats (struct thread *t, struct vm_stats *stats) {
+	struct supplemental_page_table *spt = &t->spt;
+	struct hash_iterator i;
+
+	memset(stats, 0, sizeof *stats);
+	lock_acquire(&spt->lock);
+	lock_acquire(&frame_lock);
+	hash_first(&i, &spt->spt_hash_table);
+	while(hash_next(&i)){
+		struct page *page = hash_entry(hash_cur(&i), struct page, spt_elem);
+		if(page->frame == NULL){
+			if(VM_TYPE(page->operations->type) == VM_ANON && page->anon.idx != BITMAP_ERROR){
+				stats->swapped++;
+			}
+			continue;
+		}
+		struct phys_frame *pf = vm_phys_frame(page->frame->kva);
+		stats->resident++;
+		if(pf->cpy_cnt > 0 || list_begin(&pf->rmap) != list_rbegin(&pf->rmap)){
+			stats->shared++;
+		}
+		if(page_get_type(page) == VM_FILE){
+			stats->file++;
+		}
+	}
+	lock_release(&frame_lock);
+	lock_release(&spt->lock);
+	stats->faults = t->vm_faults;
+	stats->major_faults = t->vm_major_faults;
+}
+
+/* Prints the VM statistics of T, a process. */
+void
+vm_print_thread_stats (struct thread *t) {
+	struct vm_stats stats;
+	vm_thread_stats(t, &stats);
+	printf("%s: %zu pages resident (%zu shared, %zu file), %zu swapped, "
+			"%lld faults (%lld major)\n", t->name, stats.resident, stats.shared,
+			stats.file, stats.swapped, stats.faults, stats.major_faults);
+}
+
+/* Prints fault statistics. */
+void
+vm_print_stats (void) {
+	printf("VM: %zu of %zu frames free, %lld faults (%lld major)\n",
+			palloc_user_free_cnt(), palloc_user_page_cnt(), fault_cnt, major_fault_cnt);
+	printf("Fault-around: %zu page window, %lld pages mapped\n",
+			fault_around_pages, fault_around_cnt);
+	printf("Zero page: %lld read faults mapped, %lld pages written\n",
+			zero_map_cnt, zero_cow_cnt);
+	printf("Stack: %zu page chunks, %lld growth faults, %lld pages mapped ahead\n",
+			stack_chunk_pages, stack_grow_cnt, stack_eager_cnt);
+	printf("Huge pages: %lld mapped, %lld split\n", huge_map_cnt, huge_split_cnt);
 }
 
 /* Free the page.
@@ -281,26 +1035,194 @@ vm_do_claim_page (struct page *page) {
 	if (frame == NULL) {
 		return false;
 	}
-	/* Set links */
-	frame->page = page;
-	page->frame = frame;
-	
+	return vm_map_frame(page, frame);
+}
+
+/* Load PAGE into FRAME, fresh from vm_get_frame or vm_alloc_frame, and
+ * map it. The frame is unpinned on success, and freed on failure. */
+static bool
+vm_map_frame (struct page *page, struct frame *frame) {
 	/* TODO: Insert page table entry to map page's VA to frame's PA. */
 	/* Project 3 */
-	if(pml4_get_page (thread_current()->pml4, page->va) != NULL){
+	if(pml4_get_page (thread_current()->pml4, page->va) != NULL
+			|| !pml4_set_page(thread_current()->pml4, page->va, frame->kva, page->writable)){
+		vm_free_frame(frame);
 		return false;
 	}
-	if(pml4_set_page(thread_current()->pml4, page->va, frame->kva, page->writable) == false){
+	if(!vm_load_frame(page, frame)){
+		pml4_clear_page(thread_current()->pml4, page->va);
 		return false;
 	}
-	return swap_in (page, frame->kva);
+	/* A file page only knows its area once loaded. */
+	if(page->writable && !vm_page_writable(page)){
+		pml4_set_writable(thread_current()->pml4, page->va, false);
+	}
+	vm_unpin_frame(frame->kva);
+	return true;
 	/* Project 3 */
 }
 
+/* Link PAGE and FRAME, still pinned, and load PAGE's contents. The
+ * frame is freed on failure. */
+static bool
+vm_load_frame (struct page *page, struct frame *frame) {
+	/* Set links */
+	frame->page = page;
+	page->frame = frame;
+
+	/* Frames are reused as is: a page with no initializer, as the stack,
+	 * must not show what the frame held before. */
+	if(VM_TYPE(page->operations->type) == VM_UNINIT && page->uninit.init == NULL){
+		memset(frame->kva, 0, PGSIZE);
+	}
+	if(!swap_in (page, frame->kva)){
+		vm_free_frame(frame);
+		return false;
+	}
+	return true;
+}
+
+/* On the first touch of a LARGE_PGSIZE aligned run of a data segment
+ * or an mmap that is untouched as a whole, load the run into contiguous
+ * frames and map it with a single large page: one TLB entry and no page
+ * table for 2 MiB. The frames stay pinned, so eviction and writeback
+ * leave them alone, until vm_huge_split_map turns the mapping back into
+ * 4 KiB pages, when memory gets tight or before the pages are copied or
+ * unmapped.
+ * Returns false, changing nothing, if the run does not qualify or no
+ * aligned frames are free. Otherwise sets *LOADED to whether PAGE could
+ * be loaded. SPT must be locked. */
+static bool
+vm_huge_fault (struct supplemental_page_table *spt, struct page *page, bool *loaded) {
+	void *base = (void *) ((uintptr_t) page->va & ~(LARGE_PGSIZE - 1));
+	void *end = base + LARGE_PGSIZE;
+	struct vma *vma = vma_find(spt, page->va);
+	if(!huge_pages || vma == NULL || (vma->exec && !vma->writable) || vma->shared || base < vma->start || end > vma->end){
+		return false;
+	}
+	if(pml4_get_page(page->pml4, page->va) != NULL){
+		return false;
+	}
+	for(void *va = base; va < end; va += PGSIZE){
+		if(va != page->va && spt_find_page(spt, va) != NULL){
+			return false;
+		}
+	}
+	if(palloc_user_free_cnt() < LARGE_PGCNT + writeback_low_pages){
+		return false;
+	}
+
+	struct huge_map *map = malloc(sizeof *map);
+	struct frame **frames = malloc(LARGE_PGCNT * sizeof *frames);
+	void *kva = palloc_get_aligned(PAL_USER, LARGE_PGCNT, LARGE_PGCNT);
+	size_t cnt = 0;
+	if(map != NULL && frames != NULL && kva != NULL){
+		while(cnt < LARGE_PGCNT && (frames[cnt] = vm_new_frame(kva + cnt * PGSIZE)) != NULL){
+			cnt++;
+		}
+	}
+	bool ok = cnt == LARGE_PGCNT;
+	for(void *va = base; ok && va < end; va += PGSIZE){
+		ok = spt_find_or_create(spt, va) != NULL;
+	}
+	if(!ok){
+		/* Frames free their own kva, the rest goes back here. */
+		for(size_t i = 0; i < cnt; i++){
+			vm_free_frame(frames[i]);
+		}
+		if(kva != NULL){
+			palloc_free_multiple(kva + cnt * PGSIZE, LARGE_PGCNT - cnt);
+		}
+		free(frames);
+		free(map);
+		return false;
+	}
+
+	/* On failure, vm_load_frame frees frames[DONE]. */
+	size_t done = 0;
+	while(done < LARGE_PGCNT
+			&& vm_load_frame(spt_find_page(spt, base + done * PGSIZE), frames[done])){
+		done++;
+	}
+	*loaded = page->frame != NULL;
+	if(done == LARGE_PGCNT && page->frame != NULL
+			&& pml4_set_large_page(page->pml4, base, kva, vma->writable && vma->dirty == NULL)){
+		map->spt = spt;
+		map->pml4 = page->pml4;
+		map->va = base;
+		map->kva = kva;
+		lock_acquire(&frame_lock);
+		list_push_back(&huge_maps, &map->elem);
+		lock_release(&frame_lock);
+		huge_map_cnt++;
+		free(frames);
+		return true;
+	}
+
+	/* A page failed to load, or the large page could not be mapped: map
+	 * what was loaded a page at a time, and give back the rest. */
+	for(size_t i = 0; i < LARGE_PGCNT; i++){
+		struct frame *frame = frames[i];
+		if(i > done){
+			vm_free_frame(frame);
+		}
+		else if(i < done){
+			struct page *p = frame->page;
+			if(pml4_set_page(p->pml4, p->va, frame->kva, vm_page_writable(p))){
+				vm_unpin_frame(frame->kva);
+			}
+			else{
+				vm_free_frame(frame);
+			}
+		}
+	}
+	*loaded = page->frame != NULL;
+	free(frames);
+	free(map);
+	return true;
+}
+
+/* Split MAP back into 4 KiB pages, whose frames can be evicted then.
+ * Returns false if no page table could be allocated. The frame lock
+ * must be held. */
+static bool
+vm_huge_split_map (struct huge_map *map) {
+	if(!pml4_split_large_page(map->pml4, map->va)){
+		return false;
+	}
+	for(size_t i = 0; i < LARGE_PGCNT; i++){
+		vm_phys_frame(map->kva + i * PGSIZE)->pin_cnt--;
+	}
+	list_remove(&map->elem);
+	free(map);
+	huge_split_cnt++;
+	return true;
+}
+
+/* Split the large pages of SPT in [START, END). Returns false if one of
+ * them could not be. */
+bool
+vm_huge_split (struct supplemental_page_table *spt, void *start, void *end) {
+	bool success = true;
+
+	lock_acquire(&frame_lock);
+	for(struct list_elem *e = list_begin(&huge_maps); e != list_end(&huge_maps); ){
+		struct huge_map *map = list_entry(e, struct huge_map, elem);
+		e = list_next(e);
+		if(map->spt == spt && map->va < end && map->va + LARGE_PGSIZE > start){
+			success = vm_huge_split_map(map) && success;
+		}
+	}
+	lock_release(&frame_lock);
+	return success;
+}
+
 /* Initialize new supplemental page table */
 void
 supplemental_page_table_init (struct supplemental_page_table *spt) {
 	hash_init(&spt->spt_hash_table, spt_hash_func, spt_hash_less_func, NULL);
+	spt->vmas = NULL;
+	lock_init(&spt->lock);
 }
 
 /* Copy supplemental page table from src to dst */
@@ -308,61 +1230,67 @@ bool
 supplemental_page_table_copy (struct supplemental_page_table *dst,
 		struct supplemental_page_table *src) {
 	/* Project 3 */
+	bool success = true;
 	struct hash_iterator i;
+
+	lock_acquire(&src->lock);
+	lock_acquire(&dst->lock);
+	/* Sharing frames copy-on-write takes 4 KiB ptes. */
+	success = vm_huge_split(src, NULL, (void *) KERN_BASE) && vma_copy(dst, src);
 	hash_first (&i, &src->spt_hash_table);
-	while (hash_next (&i)){
+	while (success && hash_next (&i)){
 		struct page *page = hash_entry (hash_cur (&i), struct page, spt_elem);
-		switch(VM_TYPE(page->operations->type)){
-			case VM_UNINIT:
-				{
-				struct load_info * aux = malloc(sizeof(struct load_info));
-				memcpy(aux, (struct load_info *)page->uninit.aux, sizeof(struct load_info));
-				if(aux->file != NULL){
-					aux->file = file_reopen(aux->file);
-				}
-				if(!vm_alloc_page_with_initializer(page->uninit.type, page->va, page->writable, page->uninit.init, aux)){
-					return false;
-				}
-				if(!vm_claim_page(page->va)){
-					return false;
-				}
-				break;
-				}
-			case VM_FILE:
-				{
-				if(!vm_alloc_page (page->operations->type, page->va, page->writable)){
-					return false;
-				}
-				struct page * dst_page = spt_find_page(dst, page->va);
-				dst_page->mmap_id = page->mmap_id;
-				if(!vm_cow_frame_connect(dst_page, page)){
-					return false;
-				}
-				dst_page->file.file = file_reopen(page->file.file);
-				dst_page->file.ofs = page->file.ofs;
-				dst_page->file.page_read_bytes = page->file.page_read_bytes;
-				dst_page->file.page_zero_bytes = page->file.page_zero_bytes;
-				
-				break;
-				}
-			case VM_ANON:
-				{
-				if(!vm_alloc_page(page->operations->type, page->va, page->writable)){
-					return false;
-				}
-				struct page * dst_page = spt_find_page(dst, page->va);
+		success = spt_copy_page(dst, page);
+	}
+	lock_release(&dst->lock);
+	lock_release(&src->lock);
+	return success;
+	/* Project 3 */
+}
 
-				if(!vm_cow_frame_connect(dst_page, page)){
-					return false;
-				}
+/* Copy PAGE into DST, sharing its frame. The areas have been copied
+ * already. */
+static bool
+spt_copy_page (struct supplemental_page_table *dst, struct page *page) {
+	switch(VM_TYPE(page->operations->type)){
+		case VM_UNINIT:
+			{
+			/* DST creates the page from its own area on first touch. */
+			break;
+			}
+		case VM_FILE:
+			{
+			if(!vm_alloc_page (page->operations->type, page->va, page->writable)){
+				return false;
+			}
+			struct page * dst_page = spt_find_page(dst, page->va);
+			if(!vm_cow_frame_connect(dst_page, page)){
+				return false;
+			}
+			dst_page->file.vma = vma_find(dst, page->va);
+			dst_page->file.file = dst_page->file.vma->file;
+			dst_page->file.ofs = page->file.ofs;
+			dst_page->file.page_read_bytes = page->file.page_read_bytes;
+			dst_page->file.page_zero_bytes = page->file.page_zero_bytes;
+			
+			break;
+			}
+		case VM_ANON:
+			{
+			if(!vm_alloc_page(page->operations->type, page->va, page->writable)){
+				return false;
+			}
+			struct page * dst_page = spt_find_page(dst, page->va);
 
-				break;
-				}
+			if(!vm_cow_frame_connect(dst_page, page)){
+				return false;
+			}
+
+			break;
+			}
 
-		}
 	}
 	return true;
-	/* Project 3 */
 }
 
 /* Free the resource hold by the supplemental page table */
@@ -373,20 +1301,30 @@ supplemental_page_table_kill (struct supplemental_page_table *spt) {
 	 /* Project 3 */
 
 	struct hash_iterator i;
+	vm_writeback_flush_cancel(spt);
+	lock_acquire(&spt->lock);
+	/* If this fails, the pages of a large page are freed under it, but
+	 * the process never runs again. */
+	vm_huge_split(spt, NULL, (void *) KERN_BASE);
+	file_backed_flush(spt, NULL, (void *) KERN_BASE);
 	hash_first(&i, &spt->spt_hash_table);
 	while (hash_next(&i)){
 		struct page * page = hash_entry (hash_cur(&i), struct page, spt_elem);
-		if((page->operations->type == VM_FILE) && pml4_is_dirty(thread_current()->pml4, page->va)){
-			file_write_at(page->file.file, page->frame->kva, page->file.page_read_bytes, page->file.ofs);
-			file_close(page->file.file);
-		}
-		if(!(page->frame == NULL)&&(page->frame->cpy_cnt > 0)){
-			vm_set_cpy_cnt(page->frame->kva, page->frame->cpy_cnt-1);
+		struct frame * frame = vm_pin_page_frame(page);
+		if(frame == NULL){
+			/* It may still map the zero page, which pml4_destroy must not
+			 * free. */
 			pml4_clear_page(thread_current()->pml4, page->va);
+			destroy(page);
+			continue;
 		}
+		pml4_clear_page(thread_current()->pml4, page->va);
+		vm_free_frame(frame);
 		destroy(page);
 	}
 	hash_clear(&spt->spt_hash_table, NULL);
+	vma_unmap_all(spt);
+	lock_release(&spt->lock);
 	 /* Project 3 */
 }
 
@@ -403,80 +1341,315 @@ bool spt_hash_less_func (const struct hash_elem *a, const struct hash_elem *b, v
 	return page_a->va < page_b->va;
 }
 
+/* Returns the descriptor of the physical user page at KVA. */
+struct phys_frame *vm_phys_frame (void * kva) {
+	return &phys_frames[palloc_user_page_idx(kva)];
+}
+
+/* Returns the descriptor of the IDX'th user pool page. */
+struct phys_frame *vm_phys_frame_at (size_t idx) {
+	return &phys_frames[idx];
+}
+
+/* Unlink FRAME from its page and drop its share of the kva. The kva goes
+ * back to the user pool when no other frame maps it. The caller must have
+ * pinned the kva, and cleared the page's pte. The pin goes with it. */
+void vm_free_frame (struct frame * frame) {
+	struct phys_frame *pf = vm_phys_frame(frame->kva);
+
+	lock_acquire(&frame_lock);
+	pf->pin_cnt--;
+	list_remove(&frame->rmap_elem);
+	if(list_empty(&pf->rmap)){
+		pf->cpy_cnt = 0;
+		vm_text_remove(frame->kva);
+		palloc_free_page(frame->kva);
+	}
+	else{
+		vm_dec_cpy_cnt(frame->kva, 1);
+	}
+	if(frame->page != NULL){
+		frame->page->frame = NULL;
+	}
+	lock_release(&frame_lock);
+	free(frame);
+}
+
+/* Let KVA be evicted again. */
+void vm_unpin_frame (void * kva) {
+	lock_acquire(&frame_lock);
+	vm_phys_frame(kva)->pin_cnt--;
+	ASSERT(vm_phys_frame(kva)->pin_cnt >= 0);
+	lock_release(&frame_lock);
+}
+
+/* Wait until no I/O is in flight on PAGE, and pin its frame so that it
+ * stays resident. Returns the frame, or NULL if PAGE is not resident. */
+struct frame *vm_pin_page_frame (struct page * page) {
+	lock_acquire(&frame_lock);
+	vm_page_wait(page);
+	struct frame *frame = page->frame;
+	if(frame != NULL){
+		vm_phys_frame(frame->kva)->pin_cnt++;
+	}
+	lock_release(&frame_lock);
+	return frame;
+}
+
+/* Mark every page sharing FRAME's kva busy, or not busy, pinning or
+ * unpinning the kva along. I/O can then go on the kva without the frame
+ * lock: busy pages are not faulted in, shared, copied or freed until it
+ * is over. The frame lock must be held. */
+void vm_frame_set_busy (struct frame * frame, bool busy) {
+	struct phys_frame *pf = vm_phys_frame(frame->kva);
+	pf->pin_cnt += busy ? 1 : -1;
+	for(struct list_elem * e = list_begin(&pf->rmap); e != list_end(&pf->rmap); e = list_next(e)){
+		struct page *page = list_entry(e, struct frame, rmap_elem)->page;
+		if(page != NULL){
+			page->busy = busy;
+		}
+	}
+	if(!busy){
+		cond_broadcast(&page_unbusy, &frame_lock);
+	}
+}
+
+/* Mark PAGE, which has no frame, busy so that it is not swapped in while
+ * I/O goes around it, or not busy. Returns false if PAGE got a frame or
+ * is busy already. The frame lock must be held. */
+bool vm_page_set_busy (struct page * page, bool busy) {
+	if(busy){
+		if(page->frame != NULL || page->busy){
+			return false;
+		}
+		page->busy = true;
+	}else{
+		ASSERT(page->frame == NULL);
+		page->busy = false;
+		cond_broadcast(&page_unbusy, &frame_lock);
+	}
+	return true;
+}
+
+/* Wait until PAGE is not busy. The frame lock must be held. */
+static void vm_page_wait (struct page * page) {
+	while(page->busy){
+		cond_wait(&page_unbusy, &frame_lock);
+	}
+}
+
+/* Evict pages until CNT frames went back to the user pool, or nothing
+ * more can be evicted. Returns the number of frames freed. */
+size_t vm_reclaim_frames (size_t cnt) {
+	size_t freed = 0;
+
+	lock_acquire(&evict_lock);
+	while(freed < cnt){
+		struct frame *frame = vm_evict_frame();
+		if(frame == NULL){
+			break;
+		}
+		lock_acquire(&frame_lock);
+		vm_phys_frame(frame->kva)->pin_cnt--;
+		list_remove(&frame->rmap_elem);
+		palloc_free_page(frame->kva);
+		lock_release(&frame_lock);
+		free(frame);
+		freed++;
+	}
+	lock_release(&evict_lock);
+	return freed;
+}
+
+/* Returns true if any page mapping FRAME's kva has been accessed, and
+ * clears the accessed bit of every one of them. */
+bool vm_frame_test_and_clear_accessed (struct frame * frame) {
+	struct phys_frame *pf = vm_phys_frame(frame->kva);
+	bool accessed = false;
+	for(struct list_elem * e = list_begin(&pf->rmap); e != list_end(&pf->rmap); e = list_next(e)){
+		struct page *page = list_entry(e, struct frame, rmap_elem)->page;
+		if(page != NULL && pml4_is_accessed(page->pml4, page->va)){
+			pml4_set_accessed(page->pml4, page->va, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Returns true if any page mapping FRAME's kva has dirtied it. */
+bool vm_frame_is_dirty (struct frame * frame) {
+	struct phys_frame *pf = vm_phys_frame(frame->kva);
+	for(struct list_elem * e = list_begin(&pf->rmap); e != list_end(&pf->rmap); e = list_next(e)){
+		struct page *page = list_entry(e, struct frame, rmap_elem)->page;
+		if(page != NULL && pml4_is_dirty(page->pml4, page->va)){
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Returns true if any page mapping FRAME's kva has dirtied it, and
+ * clears the dirty bit of every one of them. */
+bool vm_frame_test_and_clear_dirty (struct frame * frame) {
+	struct phys_frame *pf = vm_phys_frame(frame->kva);
+	bool dirty = false;
+	for(struct list_elem * e = list_begin(&pf->rmap); e != list_end(&pf->rmap); e = list_next(e)){
+		struct page *page = list_entry(e, struct frame, rmap_elem)->page;
+		if(page != NULL && pml4_is_dirty(page->pml4, page->va)){
+			pml4_set_dirty(page->pml4, page->va, false);
+			dirty = true;
+		}
+	}
+	return dirty;
+}
+
+/* Clears the pte of every page mapping FRAME's kva. Returns true if any
+ * of them had dirtied the kva. */
+bool vm_frame_unmap_all (struct frame * frame) {
+	struct phys_frame *pf = vm_phys_frame(frame->kva);
+	bool dirty = false;
+	for(struct list_elem * e = list_begin(&pf->rmap); e != list_end(&pf->rmap); e = list_next(e)){
+		struct page *page = list_entry(e, struct frame, rmap_elem)->page;
+		if(page == NULL){
+			continue;
+		}
+		if(pml4_is_dirty(page->pml4, page->va)){
+			pml4_set_dirty(page->pml4, page->va, false);
+			dirty = true;
+		}
+		pml4_clear_page(page->pml4, page->va);
+	}
+	return dirty;
+}
+
+/* Returns true if PAGE, loaded, may be mapped writable when it does not
+ * share its frame. */
+static bool vm_page_writable (struct page * page) {
+	return page->writable
+		&& (VM_TYPE(page->operations->type) != VM_FILE || file_backed_writable(page));
+}
+
+/* Returns true if PAGE, loaded, belongs to a shared mapping, whose
+ * writes go to the frame it shares rather than to a copy. */
+static bool vm_page_shared (struct page * page) {
+	return VM_TYPE(page->operations->type) == VM_FILE && page->file.vma->shared;
+}
+
+/* Map PAGE to KVA with WRITABLE, keeping the dirty bit of its pte, since
+ * writeback relies on it to know whether the swap or file copy is stale. */
+static bool vm_remap_page (struct page * page, void * kva, bool writable) {
+	bool dirty = pml4_is_dirty(page->pml4, page->va);
+	if(!pml4_set_page(page->pml4, page->va, kva, writable)){
+		return false;
+	}
+	pml4_set_dirty(page->pml4, page->va, dirty);
+	return true;
+}
+
 bool vm_cow_frame_connect (struct page * dst_page, struct page * src_page) {
+	/* Keep the kva resident, and its sharers out of eviction, until
+	 * DST_PAGE is one of them. */
+	struct frame * src_frame = vm_pin_page_frame(src_page);
+	if(src_frame == NULL){
+		return vm_cow_swap_connect(dst_page, src_page);
+	}
 	struct frame * frame = (struct frame *)calloc(sizeof (struct frame), 1);
+	if(frame == NULL || !swap_in (dst_page, src_frame->kva)){
+		free(frame);
+		vm_unpin_frame(src_frame->kva);
+		return false;
+	}
 	frame->page = dst_page;
 	dst_page->frame = frame;
-	frame->kva = src_page->frame->kva;
-	list_push_back(&frame_table, &frame->ft_elem);
+	frame->kva = src_frame->kva;
+	lock_acquire(&frame_lock);
+	list_push_back(&vm_phys_frame(frame->kva)->rmap, &frame->rmap_elem);
+	vm_inc_cpy_cnt(frame->kva, 1);
+	lock_release(&frame_lock);
 
-	if(pml4_get_page(thread_current()->pml4, dst_page->va) != NULL){
+	bool success = pml4_get_page(thread_current()->pml4, dst_page->va) == NULL
+		&& pml4_set_page(thread_current()->pml4, dst_page->va, frame->kva, false);
+	vm_remap_page(src_page, src_frame->kva, false);
+	vm_unpin_frame(src_frame->kva);
+	return success;
+}
+
+/* SRC_PAGE is swapped out: DST_PAGE shares its swap slot, or reads its
+ * file back, on its first fault. */
+static bool vm_cow_swap_connect (struct page * dst_page, struct page * src_page) {
+	if(!swap_in (dst_page, NULL)){
 		return false;
 	}
-	if(pml4_set_page(thread_current()->pml4, dst_page->va, dst_page->frame->kva, false) == false){
-		return false;
+	if(VM_TYPE(src_page->operations->type) == VM_ANON && src_page->anon.idx != BITMAP_ERROR){
+		dst_page->anon.idx = src_page->anon.idx;
+		swap_ref(dst_page->anon.idx);
 	}
-
-	pml4_set_page(src_page->pml4, src_page->va, src_page->frame->kva, false);
-	vm_set_cpy_cnt(frame->kva, src_page->frame->cpy_cnt + 1);
-	return swap_in (dst_page, frame->kva);
+	return true;
 }
 
 bool vm_copy_on_write(struct page * page) {
-	struct frame* frame = page->frame;
-	void * origin_kva = frame->kva;
-	if((frame->kva = palloc_get_page(PAL_USER)) == NULL){
-		free(frame);
-		frame = vm_evict_frame();
-		if(frame == NULL){
-			return false;
-		}
-		frame->page = page;
+	/* First write to a page mapping the zero page. */
+	if(page->frame == NULL && pml4_get_page(page->pml4, page->va) == zero_page){
+		pml4_clear_page(page->pml4, page->va);
+		zero_cow_cnt++;
+		return vm_do_claim_page(page);
+	}
+	/* Keep the original from being evicted while it is copied. */
+	struct frame * old_frame = vm_pin_page_frame(page);
+	if(old_frame == NULL){
+		/* Evicted meanwhile: the write faults it back in. */
+		return true;
 	}
+	void * origin_kva = old_frame->kva;
+	struct phys_frame * origin = vm_phys_frame(origin_kva);
 
-	if(pml4_set_page(thread_current()->pml4, page->va, frame->kva, page->writable) == false){
+	/* Last mapper of the kva, or a shared mapping: no need to copy, just
+	 * get write back. */
+	lock_acquire(&frame_lock);
+	if(origin->cpy_cnt == 0 || vm_page_shared(page)){
+		bool success = vm_remap_page(page, origin_kva, page->writable);
+		origin->pin_cnt--;
+		lock_release(&frame_lock);
+		return success;
+	}
+	lock_release(&frame_lock);
+
+	struct frame * frame = vm_get_frame();
+	if(frame == NULL){
+		vm_unpin_frame(origin_kva);
 		return false;
 	}
-	vm_set_cpy_cnt(origin_kva, frame->cpy_cnt-1);
-	frame->cpy_cnt = 0;
 	memcpy(frame->kva, origin_kva, PGSIZE);
+	old_frame->page = NULL;
+	vm_free_frame(old_frame);
 
-	return true;
-
+	frame->page = page;
+	page->frame = frame;
+	bool success = vm_remap_page(page, frame->kva, page->writable);
+	vm_unpin_frame(frame->kva);
+	return success;
 }
 
+/* Drop CNT shares of KVA. When a single mapper is left it gets write
+ * access back, if its page is writable. */
 void vm_dec_cpy_cnt(void * kva, int cnt){
-	for(struct list_elem * e = list_begin(&frame_table); (e != list_end(&frame_table)) && cnt != 0; e = list_next(e)){
-		struct frame *frame = list_entry(e, struct frame, ft_elem);
-		if(frame->kva == kva){
-			if(--frame->cpy_cnt == 0){
-				pml4_set_page(frame->page->pml4, frame->page->va, frame->kva, frame->page->writable);
-			}
-			ASSERT(frame->cpy_cnt >= 0);
-			cnt--;
+	struct phys_frame *pf = vm_phys_frame(kva);
+	pf->cpy_cnt -= cnt;
+	ASSERT(pf->cpy_cnt >= 0);
+	if(pf->cpy_cnt == 0 && !list_empty(&pf->rmap)){
+		struct frame *frame = list_entry(list_front(&pf->rmap), struct frame, rmap_elem);
+		if(frame->page != NULL){
+			vm_remap_page(frame->page, frame->kva, vm_page_writable(frame->page));
 		}
 	}
 }
 
 void vm_inc_cpy_cnt(void * kva, int cnt){
-	for(struct list_elem * e = list_begin(&frame_table); (e != list_end(&frame_table)) && cnt != 0; e = list_next(e)){
-		struct frame *frame = list_entry(e, struct frame, ft_elem);
-		if(frame->kva == kva){
-			frame->cpy_cnt++;
-			cnt--;
-		}
-	}
+	vm_phys_frame(kva)->cpy_cnt += cnt;
 }
 
 void vm_set_cpy_cnt(void * kva, int cpy_cnt){
-	for(struct list_elem * e = list_begin(&frame_table); (e != list_end(&frame_table)); e = list_next(e)){
-		struct frame *frame = list_entry(e, struct frame, ft_elem);
-		if(frame->kva == kva){
-			frame->cpy_cnt = cpy_cnt;
-		}
-	}
+	vm_phys_frame(kva)->cpy_cnt = cpy_cnt;
 }
 
 /* Project 3 */
-
-
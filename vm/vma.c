@@ -0,0 +1,300 @@
+/* vma.c: Virtual memory areas.
+ *
+ * Executable segments and mmaps are recorded as areas when they are set
+ * up, so the cost of loading or mapping does not grow with their size.
+ * The fault handler finds the area of a faulting address and creates
+ * its struct page then.
+ *
+ * Each process keeps its areas in an AVL tree keyed by start address.
+ * Since areas never overlap, the area holding an address is the one with
+ * the greatest start not above it, found in O(log n). */
+
+#include "vm/vma.h"
+#include <bitmap.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+
+static int height (struct vma *vma);
+static void update_height (struct vma *vma);
+static struct vma *rotate_left (struct vma *vma);
+static struct vma *rotate_right (struct vma *vma);
+static struct vma *balance (struct vma *vma);
+static struct vma *tree_insert (struct vma *root, struct vma *vma);
+static struct vma *tree_remove (struct vma *root, struct vma *vma);
+static struct vma *remove_min (struct vma *root, struct vma **min);
+static bool copy (struct supplemental_page_table *dst, struct vma *vma);
+static void free_tree (struct vma *root);
+
+/* Add an area of LENGTH bytes, rounded up to whole pages, at START. Its
+ * first READ_BYTES bytes are read from FILE at OFS, if FILE is not NULL,
+ * and the rest is zeroed. The area holds its own reopened FILE. Returns
+ * the area, or NULL if it would overlap another area or on allocation
+ * failure. A writable mmap gets a dirty set, see file_backed_flush. */
+struct vma *
+vma_map (struct supplemental_page_table *spt, void *start, size_t length,
+		enum vm_type type, bool writable, struct file *file, off_t ofs,
+		size_t read_bytes) {
+	ASSERT (pg_ofs (start) == 0);
+	ASSERT (VM_TYPE (type) == VM_ANON || VM_TYPE (type) == VM_FILE);
+
+	void *end = start + ROUND_UP (length, PGSIZE);
+	if (length == 0 || end < start || vma_overlaps (spt, start, end))
+		return NULL;
+
+	struct vma *vma = malloc (sizeof *vma);
+	if (vma == NULL)
+		return NULL;
+	vma->start = start;
+	vma->end = end;
+	vma->type = type;
+	vma->writable = writable;
+	vma->exec = false;
+	vma->shared = false;
+	vma->advice = MADV_NORMAL;
+	vma->dirty = NULL;
+	vma->file = NULL;
+	if (file != NULL) {
+		vma->file = file_reopen (file);
+		if (vma->file == NULL) {
+			free (vma);
+			return NULL;
+		}
+	}
+	if (VM_TYPE (type) == VM_FILE && writable && file != NULL) {
+		vma->dirty = bitmap_create ((end - start) / PGSIZE);
+		if (vma->dirty == NULL) {
+			file_close (vma->file);
+			free (vma);
+			return NULL;
+		}
+	}
+	vma->ofs = ofs;
+	vma->read_bytes = file != NULL ? read_bytes : 0;
+	spt->vmas = tree_insert (spt->vmas, vma);
+	return vma;
+}
+
+/* Remove VMA from SPT and free it. Its pages must be gone already. */
+void
+vma_unmap (struct supplemental_page_table *spt, struct vma *vma) {
+	spt->vmas = tree_remove (spt->vmas, vma);
+	if (vma->file != NULL)
+		file_close (vma->file);
+	if (vma->dirty != NULL)
+		bitmap_destroy (vma->dirty);
+	free (vma);
+}
+
+/* Returns the area holding VA, or NULL. */
+struct vma *
+vma_find (struct supplemental_page_table *spt, const void *va) {
+	struct vma *found = NULL;
+	for (struct vma *vma = spt->vmas; vma != NULL; ) {
+		if (va < vma->start)
+			vma = vma->left;
+		else {
+			found = vma;
+			vma = vma->right;
+		}
+	}
+	return found != NULL && va < found->end ? found : NULL;
+}
+
+/* Returns the first area ending above VA, or NULL. */
+struct vma *
+vma_first (struct supplemental_page_table *spt, const void *va) {
+	struct vma *found = NULL;
+	for (struct vma *vma = spt->vmas; vma != NULL; ) {
+		if (vma->end > va) {
+			found = vma;
+			vma = vma->left;
+		} else
+			vma = vma->right;
+	}
+	return found;
+}
+
+/* Returns true if an area overlaps [START, END). */
+bool
+vma_overlaps (struct supplemental_page_table *spt, const void *start,
+		const void *end) {
+	struct vma *last = NULL;
+	for (struct vma *vma = spt->vmas; vma != NULL; ) {
+		if (vma->start < end) {
+			last = vma;
+			vma = vma->right;
+		} else
+			vma = vma->left;
+	}
+	return last != NULL && last->end > start;
+}
+
+/* Copy the areas of SRC into DST, which has none. */
+bool
+vma_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	return copy (dst, src->vmas);
+}
+
+/* Remove every area of SPT. Their pages must be gone already. */
+void
+vma_unmap_all (struct supplemental_page_table *spt) {
+	free_tree (spt->vmas);
+	spt->vmas = NULL;
+}
+
+/* Extend VMA down to START. Returns false if that would overlap another
+ * area. */
+bool
+vma_grow_down (struct supplemental_page_table *spt, struct vma *vma,
+		void *start) {
+	ASSERT (pg_ofs (start) == 0);
+	ASSERT (vma->file == NULL);
+
+	if (start >= vma->start)
+		return true;
+	if (vma_overlaps (spt, start, vma->start))
+		return false;
+	/* No area lies between, so VMA keeps its place in the tree. */
+	vma->start = start;
+	return true;
+}
+
+/* Returns the offset in VMA's file of page UPAGE of VMA. */
+off_t
+vma_page_ofs (struct vma *vma, const void *upage) {
+	return vma->ofs + (upage - vma->start);
+}
+
+/* Returns the number of bytes of page UPAGE of VMA read from its file. */
+size_t
+vma_page_read_bytes (struct vma *vma, const void *upage) {
+	size_t page_ofs = upage - vma->start;
+	if (page_ofs >= vma->read_bytes)
+		return 0;
+	return vma->read_bytes - page_ofs < PGSIZE
+		? vma->read_bytes - page_ofs : PGSIZE;
+}
+
+static bool
+copy (struct supplemental_page_table *dst, struct vma *vma) {
+	if (vma == NULL)
+		return true;
+	struct vma *copy_vma = vma_map (dst, vma->start, vma->end - vma->start,
+			vma->type, vma->writable, vma->file, vma->ofs, vma->read_bytes);
+	if (copy_vma == NULL)
+		return false;
+	copy_vma->exec = vma->exec;
+	copy_vma->shared = vma->shared;
+	copy_vma->advice = vma->advice;
+	return copy (dst, vma->left) && copy (dst, vma->right);
+}
+
+static void
+free_tree (struct vma *root) {
+	if (root == NULL)
+		return;
+	free_tree (root->left);
+	free_tree (root->right);
+	if (root->file != NULL)
+		file_close (root->file);
+	if (root->dirty != NULL)
+		bitmap_destroy (root->dirty);
+	free (root);
+}
+
+static int
+height (struct vma *vma) {
+	return vma != NULL ? vma->height : 0;
+}
+
+static void
+update_height (struct vma *vma) {
+	int l = height (vma->left), r = height (vma->right);
+	vma->height = (l > r ? l : r) + 1;
+}
+
+static struct vma *
+rotate_left (struct vma *vma) {
+	struct vma *right = vma->right;
+	vma->right = right->left;
+	right->left = vma;
+	update_height (vma);
+	update_height (right);
+	return right;
+}
+
+static struct vma *
+rotate_right (struct vma *vma) {
+	struct vma *left = vma->left;
+	vma->left = left->right;
+	left->right = vma;
+	update_height (vma);
+	update_height (left);
+	return left;
+}
+
+/* Restore the AVL invariant at VMA, whose subtrees are balanced and
+ * differ in height by at most 2. Returns the new root of the subtree. */
+static struct vma *
+balance (struct vma *vma) {
+	update_height (vma);
+	int diff = height (vma->left) - height (vma->right);
+	if (diff > 1) {
+		if (height (vma->left->left) < height (vma->left->right))
+			vma->left = rotate_left (vma->left);
+		return rotate_right (vma);
+	}
+	if (diff < -1) {
+		if (height (vma->right->right) < height (vma->right->left))
+			vma->right = rotate_right (vma->right);
+		return rotate_left (vma);
+	}
+	return vma;
+}
+
+static struct vma *
+tree_insert (struct vma *root, struct vma *vma) {
+	if (root == NULL) {
+		vma->left = vma->right = NULL;
+		vma->height = 1;
+		return vma;
+	}
+	if (vma->start < root->start)
+		root->left = tree_insert (root->left, vma);
+	else
+		root->right = tree_insert (root->right, vma);
+	return balance (root);
+}
+
+static struct vma *
+tree_remove (struct vma *root, struct vma *vma) {
+	ASSERT (root != NULL);
+	if (vma->start < root->start)
+		root->left = tree_remove (root->left, vma);
+	else if (vma->start > root->start)
+		root->right = tree_remove (root->right, vma);
+	else {
+		if (root->right == NULL)
+			return root->left;
+		struct vma *min;
+		struct vma *right = remove_min (root->right, &min);
+		min->left = root->left;
+		min->right = right;
+		root = min;
+	}
+	return balance (root);
+}
+
+/* Unlink the leftmost node of ROOT into *MIN. Returns the new root. */
+static struct vma *
+remove_min (struct vma *root, struct vma **min) {
+	if (root->left == NULL) {
+		*min = root;
+		return root->right;
+	}
+	root->left = remove_min (root->left, min);
+	return balance (root);
+}
@@ -0,0 +1,232 @@
+/* writeback.c: Background writeback of dirty frames.
+ *
+ * Evicting a dirty frame costs a disk write in the faulting thread. The
+ * writeback daemon wakes up when the user pool runs out, and until free
+ * frames are back above the high watermark it
+ *
+ *   - writes back the dirty frames the eviction hand is about to reach,
+ *     so that eviction usually finds them clean and just drops them, and
+ *   - evicts frames on its own while free frames are below the low
+ *     watermark, so that faults usually find a free frame.
+ *
+ * It also writes back the mmaps that msync (MS_ASYNC) hands it. */
+
+#include "vm/vm.h"
+#include "vm/evict.h"
+#include "vm/writeback.h"
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Ticks between two passes of the daemon. */
+#define WRITEBACK_INTERVAL 4
+
+/* Maximum number of frames written back in one pass. */
+#define WRITEBACK_BATCH 32
+
+/* Passes above the high watermark before the daemon goes back to sleep. */
+#define WRITEBACK_IDLE_PASSES 25
+
+/* -wb-low=N, -wb-high=N */
+size_t writeback_low_pages = 8;
+size_t writeback_high_pages = 16;
+
+static struct semaphore writeback_wake;
+static bool writeback_awake;
+
+/* A range of mmaps to write back, from msync (MS_ASYNC). */
+struct flush_request {
+	struct supplemental_page_table *spt;
+	void *start, *end;
+	struct list_elem elem;
+};
+
+/* Pending flush requests, oldest first. Protected by flush_lock, which
+ * is taken before an spt lock, never after. */
+static struct list flush_requests;
+static struct lock flush_lock;
+
+/* Statistics. */
+static long long clean_cnt;		/* Number of frames written back. */
+static long long reclaim_cnt;	/* Number of frames evicted. */
+static long long flush_cnt;		/* Number of flush requests done. */
+
+static void writeback_daemon (void *aux);
+static void writeback_pass (size_t cnt);
+static void writeback_flush (void);
+static void writeback_frame (struct frame *frame);
+
+/* Start the daemon, unless -wb-low=0. */
+void
+vm_writeback_init (void) {
+	sema_init (&writeback_wake, 0);
+	list_init (&flush_requests);
+	lock_init (&flush_lock);
+	if (writeback_low_pages == 0)
+		return;
+	if (writeback_high_pages < writeback_low_pages)
+		writeback_high_pages = writeback_low_pages;
+	writeback_awake = true;
+	thread_create ("writeback", PRI_DEFAULT, writeback_daemon, NULL);
+}
+
+/* Wake the daemon up, the user pool has run out. */
+void
+vm_writeback_kick (void) {
+	if (!writeback_awake) {
+		writeback_awake = true;
+		sema_up (&writeback_wake);
+	}
+}
+
+/* Have the daemon write back the dirty pages of SPT's mmaps in
+ * [START, END). Returns false if it cannot, the caller should then do it
+ * itself. */
+bool
+vm_writeback_flush_async (struct supplemental_page_table *spt,
+		void *start, void *end) {
+	if (writeback_low_pages == 0)
+		return false;
+	struct flush_request *req = malloc (sizeof *req);
+	if (req == NULL)
+		return false;
+	req->spt = spt;
+	req->start = start;
+	req->end = end;
+	lock_acquire (&flush_lock);
+	list_push_back (&flush_requests, &req->elem);
+	lock_release (&flush_lock);
+	vm_writeback_kick ();
+	return true;
+}
+
+/* Drop the flush requests of SPT, which is going away. Its pages are
+ * written back by supplemental_page_table_kill. SPT must not be locked. */
+void
+vm_writeback_flush_cancel (struct supplemental_page_table *spt) {
+	lock_acquire (&flush_lock);
+	for (struct list_elem *e = list_begin (&flush_requests);
+			e != list_end (&flush_requests); ) {
+		struct flush_request *req = list_entry (e, struct flush_request, elem);
+		if (req->spt == spt) {
+			e = list_remove (e);
+			free (req);
+		} else
+			e = list_next (e);
+	}
+	lock_release (&flush_lock);
+}
+
+/* Prints writeback statistics. */
+void
+vm_writeback_print_stats (void) {
+	printf ("Writeback: %lld frames cleaned, %lld frames reclaimed, "
+			"%lld msyncs\n", clean_cnt, reclaim_cnt, flush_cnt);
+}
+
+static void
+writeback_daemon (void *aux UNUSED) {
+	for (;;) {
+		writeback_awake = false;
+		sema_down (&writeback_wake);
+
+		int idle = 0;
+		while (idle < WRITEBACK_IDLE_PASSES) {
+			writeback_flush ();
+			size_t free_cnt = palloc_user_free_cnt ();
+			if (free_cnt >= writeback_high_pages) {
+				idle++;
+			} else {
+				idle = 0;
+				writeback_pass (writeback_high_pages);
+				if (free_cnt < writeback_low_pages)
+					reclaim_cnt += vm_reclaim_frames (writeback_high_pages - free_cnt);
+			}
+			timer_sleep (WRITEBACK_INTERVAL);
+		}
+	}
+}
+
+/* Write back up to CNT frames the eviction hand is about to reach. They
+ * are kept busy, so neither eviction nor a fault touches them meanwhile,
+ * and the writes are done without the frame lock. */
+static void
+writeback_pass (size_t cnt) {
+	struct frame *frames[WRITEBACK_BATCH];
+
+	if (cnt > WRITEBACK_BATCH)
+		cnt = WRITEBACK_BATCH;
+	lock_acquire (&evict_lock);
+	lock_acquire (&frame_lock);
+	cnt = vm_evict_scan_ahead (frames, cnt);
+#ifdef EFILESYS
+	/* As in eviction, page cache frames are written back apart. */
+	for (size_t i = 1; i < cnt; i++)
+		if ((page_get_type (frames[i]->page) == VM_PAGE_CACHE)
+				!= (page_get_type (frames[0]->page) == VM_PAGE_CACHE)) {
+			cnt = i;
+			break;
+		}
+#endif
+	for (size_t i = 0; i < cnt; i++)
+		vm_frame_set_busy (frames[i], true);
+	lock_release (&frame_lock);
+
+	for (size_t i = 0; i < cnt; i++)
+		writeback_frame (frames[i]);
+
+	lock_acquire (&frame_lock);
+	for (size_t i = 0; i < cnt; i++)
+		vm_frame_set_busy (frames[i], false);
+	lock_release (&frame_lock);
+	lock_release (&evict_lock);
+}
+
+/* Carry out the pending flush requests. The spt of a request is locked
+ * before flush_lock is released: an exiting process cancels its requests
+ * before it locks its spt, so it cannot free the spt under a flush. */
+static void
+writeback_flush (void) {
+	lock_acquire (&flush_lock);
+	while (!list_empty (&flush_requests)) {
+		struct flush_request *req = list_entry (list_pop_front (&flush_requests),
+				struct flush_request, elem);
+		lock_acquire (&req->spt->lock);
+		lock_release (&flush_lock);
+		file_backed_flush (req->spt, req->start, req->end);
+		lock_release (&req->spt->lock);
+		free (req);
+		flush_cnt++;
+		lock_acquire (&flush_lock);
+	}
+	lock_release (&flush_lock);
+}
+
+/* Write FRAME's contents back to its page's backing store, leaving it
+ * resident. */
+static void
+writeback_frame (struct frame *frame) {
+	struct page *page = frame->page;
+	bool cleaned = false;
+
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_ANON:
+			cleaned = anon_writeback (page);
+			break;
+		case VM_FILE:
+			cleaned = file_backed_writeback (page);
+			break;
+#ifdef EFILESYS
+		case VM_PAGE_CACHE:
+			cleaned = page_cache_clean (page);
+			break;
+#endif
+		default:
+			break;
+	}
+	if (cleaned)
+		clean_cnt++;
+}